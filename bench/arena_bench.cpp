@@ -0,0 +1,57 @@
+#include "baseline.h"
+#include "bench.h"
+#include "util.h"
+#include <cstdio>
+#include <vector>
+
+// BucketArray against the arena it replaced: the time to make `count`
+// allocations and free the arena, with small node-sized allocations only,
+// and with one in a hundred between 1 and 5 KB.
+
+#define ALLOCATION_COUNT 20000000
+
+static uint64_t sink = 0;
+
+static void make_sizes(std::vector<uint32_t> &sizes, bool mixed) {
+  uint32_t x = 12345;
+  for (uint32_t &size : sizes) {
+    x = x * 1664525 + 1013904223;
+    size = 8 + (x >> 27) * 2;
+    if (mixed && (x >> 24) < 3) {
+      size = 1024 + (x & 4095);
+    }
+  }
+}
+
+template <class Arena>
+static double measure(Arena &arena, const std::vector<uint32_t> &sizes) {
+  BenchTime begin = bench_now();
+  for (uint32_t size : sizes) {
+    char *p = arena.add(size);
+    p[0] = 1;
+    sink += (uint64_t)p & 15;
+  }
+  arena.free();
+  return nanos_per_op(begin, bench_now(), sizes.size());
+}
+
+int main() {
+  std::vector<uint32_t> sizes(ALLOCATION_COUNT);
+  for (bool mixed : {false, true}) {
+    make_sizes(sizes, mixed);
+    double arena = 1e9, huge = 1e9, old = 1e9;
+    for (uint32_t run = 0; run < BENCH_RUNS; run++) {
+      BucketArray buckets;
+      arena = bench_min(arena, measure(buckets, sizes));
+      BucketArray huge_buckets;
+      huge_buckets.huge_pages = true;
+      huge = bench_min(huge, measure(huge_buckets, sizes));
+      baseline::BucketArray baseline_buckets;
+      old = bench_min(old, measure(baseline_buckets, sizes));
+    }
+    printf("%-6s BucketArray %5.1f  with huge pages %5.1f  baseline %5.1f "
+           "ns/allocation\n",
+           mixed ? "mixed" : "small", arena, huge, old);
+  }
+  printf("(%llu)\n", (unsigned long long)(sink & 1));
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+// The arena and hash table as they were before they were rewritten, so the
+// benchmarks have something to compare against. Only the parts the
+// benchmarks use are here, and buckets are freed with delete[], but nothing
+// else changed.
+namespace baseline {
+
+// Fixed 1 KB buckets; anything bigger gets its own allocation.
+// This is a pass-by-reference/pointer datastructure.
+struct BucketArray {
+  struct Bucket {
+    char *begin;
+    char *progress;
+  };
+
+  std::vector<Bucket> buckets;
+
+  BucketArray() noexcept = default;
+  BucketArray &operator=(const BucketArray &) = delete;
+  BucketArray(BucketArray &other) = delete;
+  BucketArray(BucketArray &&other) = delete;
+  ~BucketArray() = default;
+
+  void free();
+
+  template <class Type> Type *add() noexcept {
+    return (Type *)add(sizeof(Type));
+  }
+
+  char *add(uint64_t size) noexcept;
+};
+
+// Linear probing over interleaved key/value pairs, with values bigger than
+// 4 bytes stored out of line. Growing leaves the old table in the arena.
+struct Hash {
+  uint32_t capa;
+  uint32_t size;
+  uint32_t *data;
+  BucketArray *buckets;
+
+  Hash(BucketArray *buckets, uint32_t size, uint32_t data_type);
+
+  inline void *inlineFind(uint32_t key, uint32_t data_type);
+  inline void *inlineInsert(uint32_t key, uint32_t data_type);
+  inline void *inlineRemove(uint32_t key, uint32_t data_type);
+  void *find(uint32_t key, uint32_t data_type);
+  void *insert(uint32_t key, uint32_t data_type);
+  void *remove(uint32_t key, uint32_t data_type);
+
+  template <class C> C *find(uint32_t key) {
+    return (C *)find(key, sizeof(C));
+  }
+  template <class C> C *insert(uint32_t key) {
+    return (C *)insert(key, sizeof(C));
+  }
+  template <class C> C *remove(uint32_t key) {
+    return (C *)remove(key, sizeof(C));
+  }
+};
+
+} // namespace baseline
@@ -0,0 +1,23 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+
+// Each measurement is the best of this many runs.
+#define BENCH_RUNS 5
+
+typedef std::chrono::steady_clock::time_point BenchTime;
+
+inline BenchTime bench_now() { return std::chrono::steady_clock::now(); }
+
+inline double nanos_per_op(BenchTime begin, BenchTime end, uint64_t count) {
+  return std::chrono::duration<double, std::nano>(end - begin).count() /
+         count;
+}
+
+inline double bench_min(double a, double b) { return a < b ? a : b; }
+
+// Keys spread over 30 bits in a scrambled order, and keys that miss them.
+inline uint32_t bench_key(uint32_t i) {
+  return (i * 2654435761u) & ((1u << 30) - 1);
+}
+inline uint32_t bench_miss(uint32_t i) { return bench_key(i) | 1u << 30; }
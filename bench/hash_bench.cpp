@@ -0,0 +1,130 @@
+#include "baseline.h"
+#include "bench.h"
+#include "hash.h"
+#include <cstdio>
+#include <unordered_map>
+#include <vector>
+
+// Hash against the table it replaced and std::unordered_map, with uint32_t
+// keys and values: n inserts, n hits, n misses and n removes.
+
+struct Timing {
+  double insert, hit, miss, remove;
+};
+
+static uint64_t sink = 0;
+
+// Runs the four loops on an empty table and keeps the best time of each.
+template <class Table>
+static void measure(Timing &best, uint32_t n, Table &table) {
+  BenchTime begin = bench_now();
+  for (uint32_t i = 0; i < n; i++) {
+    table.insert(bench_key(i), i);
+  }
+  BenchTime inserted = bench_now();
+  for (uint32_t i = 0; i < n; i++) {
+    sink += table.find(bench_key(i));
+  }
+  BenchTime hit = bench_now();
+  for (uint32_t i = 0; i < n; i++) {
+    sink += table.find(bench_miss(i));
+  }
+  BenchTime missed = bench_now();
+  for (uint32_t i = 0; i < n; i++) {
+    sink += table.remove(bench_key(i));
+  }
+  BenchTime removed = bench_now();
+  table.free();
+
+  best.insert = bench_min(best.insert, nanos_per_op(begin, inserted, n));
+  best.hit = bench_min(best.hit, nanos_per_op(inserted, hit, n));
+  best.miss = bench_min(best.miss, nanos_per_op(hit, missed, n));
+  best.remove = bench_min(best.remove, nanos_per_op(missed, removed, n));
+}
+
+// The same four operations on each table. find() and remove() return the
+// value, or 0 when the key isn't there.
+struct HashTable {
+  BucketArray *buckets;
+  Hash<uint32_t, uint32_t> hash;
+
+  explicit HashTable(BucketArray *_buckets)
+      : buckets(_buckets), hash(_buckets) {}
+  void insert(uint32_t key, uint32_t value) { *hash.insert(key) = value; }
+  uint32_t find(uint32_t key) {
+    uint32_t *value = hash.find(key);
+    return value == nullptr ? 0 : *value;
+  }
+  uint32_t remove(uint32_t key) {
+    uint32_t *value = hash.remove(key);
+    return value == nullptr ? 0 : *value;
+  }
+  void free() { buckets->free(); }
+};
+
+struct BaselineTable {
+  baseline::BucketArray *buckets;
+  baseline::Hash hash;
+
+  explicit BaselineTable(baseline::BucketArray *_buckets)
+      : buckets(_buckets), hash(_buckets, 8, sizeof(uint32_t)) {}
+  void insert(uint32_t key, uint32_t value) {
+    *hash.insert<uint32_t>(key) = value;
+  }
+  uint32_t find(uint32_t key) {
+    uint32_t *value = hash.find<uint32_t>(key);
+    return value == nullptr ? 0 : *value;
+  }
+  uint32_t remove(uint32_t key) {
+    uint32_t *value = hash.remove<uint32_t>(key);
+    return value == nullptr ? 0 : *value;
+  }
+  void free() { buckets->free(); }
+};
+
+struct StdTable {
+  std::unordered_map<uint32_t, uint32_t> map;
+
+  void insert(uint32_t key, uint32_t value) { map[key] = value; }
+  uint32_t find(uint32_t key) {
+    auto it = map.find(key);
+    return it == map.end() ? 0 : it->second;
+  }
+  uint32_t remove(uint32_t key) {
+    auto it = map.find(key);
+    if (it == map.end()) {
+      return 0;
+    }
+    uint32_t value = it->second;
+    map.erase(it);
+    return value;
+  }
+  void free() { map.clear(); }
+};
+
+static void print(const char *name, uint32_t n, const Timing &timing) {
+  printf("%-14s n=%-9u insert %6.1f  hit %6.1f  miss %6.1f  remove %6.1f "
+         "ns/op\n",
+         name, n, timing.insert, timing.hit, timing.miss, timing.remove);
+}
+
+int main() {
+  for (uint32_t n = 1000; n <= 10000000; n *= 10) {
+    Timing hash = {1e9, 1e9, 1e9, 1e9};
+    Timing old = hash, std_map = hash;
+    for (uint32_t run = 0; run < BENCH_RUNS; run++) {
+      BucketArray buckets;
+      HashTable hash_table(&buckets);
+      measure(hash, n, hash_table);
+      baseline::BucketArray baseline_buckets;
+      BaselineTable baseline_table(&baseline_buckets);
+      measure(old, n, baseline_table);
+      StdTable std_table;
+      measure(std_map, n, std_table);
+    }
+    print("Hash", n, hash);
+    print("baseline Hash", n, old);
+    print("unordered_map", n, std_map);
+  }
+  printf("(%llu)\n", (unsigned long long)(sink & 1));
+}
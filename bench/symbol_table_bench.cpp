@@ -0,0 +1,116 @@
+#include "baseline.h"
+#include "bench.h"
+#include "typechecking.h"
+#include <cstdio>
+
+// SymbolTable against the table per scope it replaced, where each scope had
+// its own Hash and a lookup walked out through the parents. For each depth:
+// entering `depth` nested scopes with 4 declarations each and leaving them
+// again, and 64 lookups of names spread over all the scopes.
+
+#define DECLARATIONS_PER_SCOPE 4
+#define LOOKUPS 64
+
+static uint64_t sink = 0;
+
+struct ChainedScope {
+  baseline::Hash symbols;
+  ChainedScope *parent;
+
+  ChainedScope(baseline::BucketArray *buckets, ChainedScope *_parent)
+      : symbols(buckets, 8, sizeof(Type)), parent(_parent) {}
+
+  Type *find(uint32_t name) {
+    for (ChainedScope *scope = this; scope != nullptr; scope = scope->parent) {
+      Type *type = scope->symbols.find<Type>(name);
+      if (type != nullptr) {
+        return type;
+      }
+    }
+    return nullptr;
+  }
+};
+
+static uint32_t lookup_name(uint32_t i, uint32_t depth) {
+  return (i * 2654435761u) % (depth * DECLARATIONS_PER_SCOPE);
+}
+
+struct Timing {
+  double scope, lookup;
+};
+
+static void measure_flat(Timing &best, uint32_t depth, uint32_t reps) {
+  BucketArray buckets;
+  SymbolTable table(&buckets);
+  double scopes = 0, lookups = 0;
+  for (uint32_t rep = 0; rep < reps; rep++) {
+    BenchTime begin = bench_now();
+    for (uint32_t d = 0; d < depth; d++) {
+      table.push_scope();
+      for (uint32_t k = 0; k < DECLARATIONS_PER_SCOPE; k++) {
+        table.declare(d * DECLARATIONS_PER_SCOPE + k, Type{});
+      }
+    }
+    BenchTime entered = bench_now();
+    for (uint32_t i = 0; i < LOOKUPS; i++) {
+      sink += table.find(lookup_name(i, depth)) != nullptr;
+    }
+    BenchTime looked_up = bench_now();
+    for (uint32_t d = 0; d < depth; d++) {
+      table.pop_scope();
+    }
+    BenchTime left = bench_now();
+    scopes +=
+        nanos_per_op(begin, entered, 1) + nanos_per_op(looked_up, left, 1);
+    lookups += nanos_per_op(entered, looked_up, 1);
+  }
+  buckets.free();
+  best.scope = bench_min(best.scope, scopes / reps / depth);
+  best.lookup = bench_min(best.lookup, lookups / reps / LOOKUPS);
+}
+
+static void measure_chained(Timing &best, uint32_t depth, uint32_t reps) {
+  baseline::BucketArray buckets;
+  double scopes = 0, lookups = 0;
+  for (uint32_t rep = 0; rep < reps; rep++) {
+    BenchTime begin = bench_now();
+    ChainedScope *scope = nullptr;
+    for (uint32_t d = 0; d < depth; d++) {
+      scope = new (buckets.add<ChainedScope>()) ChainedScope(&buckets, scope);
+      for (uint32_t k = 0; k < DECLARATIONS_PER_SCOPE; k++) {
+        *scope->symbols.insert<Type>(d * DECLARATIONS_PER_SCOPE + k) = Type{};
+      }
+    }
+    BenchTime entered = bench_now();
+    for (uint32_t i = 0; i < LOOKUPS; i++) {
+      sink += scope->find(lookup_name(i, depth)) != nullptr;
+    }
+    BenchTime looked_up = bench_now();
+    // Leaving a scope just dropped it; its table stayed in the arena.
+    while (scope != nullptr) {
+      scope = scope->parent;
+    }
+    BenchTime left = bench_now();
+    scopes +=
+        nanos_per_op(begin, entered, 1) + nanos_per_op(looked_up, left, 1);
+    lookups += nanos_per_op(entered, looked_up, 1);
+  }
+  buckets.free();
+  best.scope = bench_min(best.scope, scopes / reps / depth);
+  best.lookup = bench_min(best.lookup, lookups / reps / LOOKUPS);
+}
+
+int main() {
+  for (uint32_t depth : {4u, 32u, 256u, 2048u}) {
+    uint32_t reps = 250000 / depth + 1;
+    Timing flat = {1e9, 1e9}, chained = {1e9, 1e9};
+    for (uint32_t run = 0; run < BENCH_RUNS; run++) {
+      measure_flat(flat, depth, reps);
+      measure_chained(chained, depth, reps);
+    }
+    printf("depth %-5u scope: SymbolTable %6.1f  chained %6.1f ns   "
+           "lookup: SymbolTable %5.1f  chained %8.1f ns\n",
+           depth, flat.scope, chained.scope, flat.lookup, chained.lookup);
+  }
+  printf("(%llu)\n", (unsigned long long)(sink & 1));
+}
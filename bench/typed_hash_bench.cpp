@@ -0,0 +1,135 @@
+#include "baseline.h"
+#include "bench.h"
+#include "hash.h"
+#include "interner.h"
+#include "syntax_tree.h"
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// The two tables Hash<K, V, HashFn> replaced. Identifiers: StringInterner
+// against the std::unordered_map<String, uint32_t> the lexer used, on a
+// stream of 4M identifiers drawn from a vocabulary. Symbols: Type values in
+// a Hash<uint32_t, Type> against the untyped Hash, which kept values bigger
+// than 4 bytes out of line.
+
+#define STREAM_SIZE 4000000
+
+static uint64_t sink = 0;
+
+static void make_stream(uint32_t distinct, std::string &text,
+                        std::vector<String> &stream) {
+  uint32_t x = 3;
+  std::vector<std::string> vocabulary(distinct);
+  for (uint32_t i = 0; i < distinct; i++) {
+    x = x * 1664525 + 1013904223;
+    for (uint32_t j = 0; j < 3 + (x >> 28); j++) {
+      vocabulary[i] += "abcdefghijklmnopqrstuvwxyz_"[(x >> (j % 24)) % 27];
+    }
+    vocabulary[i] += std::to_string(i);
+  }
+
+  std::vector<uint32_t> picks(STREAM_SIZE);
+  text.clear();
+  for (uint32_t i = 0; i < STREAM_SIZE; i++) {
+    x = x * 1664525 + 1013904223;
+    picks[i] = i < distinct ? i : x % distinct;
+    text += vocabulary[picks[i]];
+    text += ' ';
+  }
+  stream.resize(STREAM_SIZE);
+  const char *p = text.data();
+  for (uint32_t i = 0; i < STREAM_SIZE; i++) {
+    stream[i] = String(p, vocabulary[picks[i]].size());
+    p += vocabulary[picks[i]].size() + 1;
+  }
+}
+
+static void bench_identifiers(uint32_t distinct) {
+  std::string text;
+  std::vector<String> stream;
+  make_stream(distinct, text, stream);
+
+  double interner = 1e9, std_map = 1e9;
+  for (uint32_t run = 0; run < BENCH_RUNS; run++) {
+    BucketArray buckets;
+    StringInterner identifiers(&buckets);
+    BenchTime begin = bench_now();
+    for (String str : stream) {
+      sink += identifiers.intern(str);
+    }
+    interner = bench_min(interner, nanos_per_op(begin, bench_now(),
+                                                STREAM_SIZE));
+    buckets.free();
+
+    std::unordered_map<String, uint32_t> map;
+    std::vector<String> strings;
+    begin = bench_now();
+    for (String str : stream) {
+      auto it = map.find(str);
+      if (it == map.end()) {
+        it = map.emplace(str, strings.size()).first;
+        strings.push_back(str);
+      }
+      sink += it->second;
+    }
+    std_map = bench_min(std_map, nanos_per_op(begin, bench_now(),
+                                              STREAM_SIZE));
+  }
+  printf("identifiers, %-8u distinct: StringInterner %5.1f  "
+         "unordered_map %5.1f ns/identifier\n",
+         distinct, interner, std_map);
+}
+
+static void bench_symbols(uint32_t n) {
+  Type type = {};
+  type.type = TypeType::Int;
+  double typed_insert = 1e9, typed_find = 1e9;
+  double untyped_insert = 1e9, untyped_find = 1e9;
+  for (uint32_t run = 0; run < BENCH_RUNS; run++) {
+    BucketArray buckets;
+    Hash<uint32_t, Type> typed(&buckets);
+    BenchTime begin = bench_now();
+    for (uint32_t i = 0; i < n; i++) {
+      *typed.insert(bench_key(i)) = type;
+    }
+    BenchTime inserted = bench_now();
+    for (uint32_t i = 0; i < n; i++) {
+      sink += (uint64_t)typed.find(bench_key(i))->type;
+    }
+    BenchTime found = bench_now();
+    typed_insert = bench_min(typed_insert, nanos_per_op(begin, inserted, n));
+    typed_find = bench_min(typed_find, nanos_per_op(inserted, found, n));
+    buckets.free();
+
+    baseline::BucketArray baseline_buckets;
+    baseline::Hash untyped(&baseline_buckets, 8, sizeof(Type));
+    begin = bench_now();
+    for (uint32_t i = 0; i < n; i++) {
+      *untyped.insert<Type>(bench_key(i)) = type;
+    }
+    inserted = bench_now();
+    for (uint32_t i = 0; i < n; i++) {
+      sink += (uint64_t)untyped.find<Type>(bench_key(i))->type;
+    }
+    found = bench_now();
+    untyped_insert =
+        bench_min(untyped_insert, nanos_per_op(begin, inserted, n));
+    untyped_find = bench_min(untyped_find, nanos_per_op(inserted, found, n));
+    baseline_buckets.free();
+  }
+  printf("symbols, n=%-8u insert: Hash<uint32_t, Type> %5.1f  baseline %5.1f"
+         "  find: %5.1f  baseline %5.1f ns/op\n",
+         n, typed_insert, untyped_insert, typed_find, untyped_find);
+}
+
+int main() {
+  for (uint32_t distinct : {1000u, 30000u, 1000000u}) {
+    bench_identifiers(distinct);
+  }
+  for (uint32_t n = 1000; n <= 1000000; n *= 10) {
+    bench_symbols(n);
+  }
+  printf("(%llu)\n", (unsigned long long)(sink & 1));
+}
@@ -0,0 +1,509 @@
+#include "ast_cache.h"
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char cache_magic[8] = {'L', 'A', 'N', 'G', 'A', 'S', 'T', 0};
+
+static_assert(sizeof(Expr) == 12 && sizeof(Stmt) == 12 && sizeof(Span) == 8 &&
+                  sizeof(Function) == 36,
+              "node layout changed; bump AST_CACHE_VERSION");
+
+void AstCache::entry_path(uint64_t source_hash, bool defer_bodies,
+                          char *path, uint64_t size) {
+  snprintf(path, size, "%s/%016llx%s.ast", directory,
+           (unsigned long long)source_hash, defer_bodies ? ".lazy" : "");
+}
+
+static bool section_valid(const CacheHeader &header,
+                          const CacheSection &section, uint64_t element_size) {
+  return section.offset % 8 == 0 && section.offset >= sizeof(CacheHeader) &&
+         section.offset <= header.file_size &&
+         section.size <= header.file_size - section.offset &&
+         section.size % element_size == 0;
+}
+
+// Points `array` at a section of the mapping, checking each element with
+// `valid(element, index)`.
+template <class T, class Valid>
+static bool borrow_section(char *base, const CacheSection &section,
+                           NodeArray<T> &array, Valid valid) {
+  if (section.size / sizeof(T) > UINT32_MAX) {
+    return false;
+  }
+  T *begin = (T *)(base + section.offset);
+  uint32_t count = section.size / sizeof(T);
+  for (uint32_t i = 0; i < count; i++) {
+    if (!valid(begin[i], i)) {
+      return false;
+    }
+  }
+  array.borrow(begin, count);
+  return true;
+}
+
+// Nodes refer to each other by index, so every index has to be inside the
+// array it points into. Children come before their parents, which also
+// rules out cycles.
+static bool expr_valid(const Expr &expr, uint32_t idx, const Expr *exprs,
+                       const uint32_t *extra, NodeCounts counts,
+                       uint32_t identifier_count) {
+  switch (expr.type) {
+  case ExprType::None:
+  case ExprType::Int:
+  case ExprType::Float:
+    return true;
+  case ExprType::Ident:
+    return expr.a < identifier_count;
+  case ExprType::Tup:
+    if ((uint64_t)expr.a + expr.b > counts.extra) {
+      return false;
+    }
+    for (uint32_t i = expr.a; i < expr.a + expr.b; i++) {
+      if (extra[i] >= idx) {
+        return false;
+      }
+    }
+    return true;
+  case ExprType::Call:
+    return expr.a < idx && expr.b < idx && exprs[expr.b].type == ExprType::Tup;
+  case ExprType::Neg:
+  case ExprType::Deref:
+  case ExprType::Range:
+  case ExprType::RangePrefix:
+  case ExprType::RangePostfix:
+    return expr.a < idx;
+  case ExprType::Add:
+  case ExprType::Sub:
+  case ExprType::Mul:
+  case ExprType::Div:
+  case ExprType::Mod:
+  case ExprType::FloorDiv:
+  case ExprType::Pow:
+  case ExprType::Attr:
+  case ExprType::Leq:
+  case ExprType::Geq:
+  case ExprType::Lt:
+  case ExprType::Gt:
+  case ExprType::Eq:
+  case ExprType::Neq:
+    return expr.a < idx && expr.b < idx;
+  }
+  return false;
+}
+
+static bool stmt_valid(const Stmt &stmt, NodeCounts counts) {
+  switch (stmt.type) {
+  case StmtType::Pass:
+    return true;
+  case StmtType::Expr:
+  case StmtType::Return:
+    return stmt.a < counts.exprs;
+  case StmtType::Assign:
+    return stmt.a < counts.exprs && stmt.b < counts.exprs;
+  case StmtType::Def:
+    return stmt.a < counts.functions;
+  }
+  return false;
+}
+
+// A nested def is added after the def it's in, so a body can only refer to
+// later functions.
+static bool function_valid(const Function &function, uint32_t idx,
+                           const Stmt *body_statements, NodeCounts counts) {
+  // `parsed` is read as a byte, since loading a bool that isn't 0 or 1 is
+  // undefined.
+  uint8_t parsed;
+  memcpy(&parsed, (const char *)&function + offsetof(Function, parsed), 1);
+  if (parsed > 1 || function.name >= counts.exprs ||
+      (uint64_t)function.params + function.param_count > counts.extra ||
+      function.body.begin > function.body.end) {
+    return false;
+  }
+  if (!function.parsed) {
+    return true;
+  }
+  if ((uint64_t)function.body_begin + function.body_count >
+      counts.body_statements) {
+    return false;
+  }
+  for (uint32_t i = function.body_begin;
+       i < function.body_begin + function.body_count; i++) {
+    const Stmt &stmt = body_statements[i];
+    if (stmt.type == StmtType::Def && stmt.a <= idx) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Walks the tree under each top-level statement. Expression spans are
+// relative to their own statement, so each one has to fit in it, and body
+// statement spans, like the body of a def, have to fit in the top-level
+// statement, since deferred bodies are parsed from the source at those
+// offsets. Every expression and def is reached from at most one place.
+struct TreeCheck {
+  struct Item {
+    Stmt stmt;
+    uint32_t length;
+  };
+
+  const Program &program;
+  std::vector<bool> seen_exprs, seen_functions;
+  std::vector<Item> statements;
+  std::vector<uint32_t> exprs;
+
+  explicit TreeCheck(const Program &program)
+      : program(program), seen_exprs(program.exprs.size()),
+        seen_functions(program.functions.size()) {}
+
+  bool exprs_valid(uint32_t root, uint32_t length) {
+    exprs.push_back(root);
+    while (!exprs.empty()) {
+      uint32_t idx = exprs.back();
+      exprs.pop_back();
+      Span span = program.expr_spans[idx];
+      if (seen_exprs[idx] || span.begin > span.end || span.end > length) {
+        return false;
+      }
+      seen_exprs[idx] = true;
+      const Expr &expr = program.exprs[idx];
+      switch (expr.type) {
+      case ExprType::None:
+      case ExprType::Int:
+      case ExprType::Float:
+      case ExprType::Ident:
+        break;
+      case ExprType::Tup:
+        exprs.insert(exprs.end(), program.children_begin(expr),
+                     program.children_end(expr));
+        break;
+      case ExprType::Neg:
+      case ExprType::Deref:
+      case ExprType::Range:
+      case ExprType::RangePrefix:
+      case ExprType::RangePostfix:
+        exprs.push_back(expr.a);
+        break;
+      default:
+        exprs.push_back(expr.a);
+        exprs.push_back(expr.b);
+      }
+    }
+    return true;
+  }
+
+  bool ident_valid(uint32_t idx, uint32_t length) {
+    return program.exprs[idx].type == ExprType::Ident &&
+           exprs_valid(idx, length);
+  }
+
+  bool def_valid(uint32_t idx, uint32_t length, uint32_t top_length) {
+    const Function &function = program.functions[idx];
+    if (seen_functions[idx] || function.body.end > top_length ||
+        !ident_valid(function.name, length)) {
+      return false;
+    }
+    seen_functions[idx] = true;
+    for (uint32_t i = function.params;
+         i < function.params + function.param_count; i++) {
+      if (!ident_valid(program.extra[i], length)) {
+        return false;
+      }
+    }
+    if (!function.parsed) {
+      return true;
+    }
+    for (uint32_t i = function.body_begin;
+         i < function.body_begin + function.body_count; i++) {
+      Span span = program.body_statement_spans[i];
+      if (span.begin > span.end || span.end > top_length) {
+        return false;
+      }
+      statements.push_back(
+          Item{program.body_statements[i], span.end - span.begin});
+    }
+    return true;
+  }
+
+  bool statement_valid(const Stmt &stmt, uint32_t length) {
+    uint32_t top_length = length;
+    statements.push_back(Item{stmt, length});
+    while (!statements.empty()) {
+      Item item = statements.back();
+      statements.pop_back();
+      bool valid = true;
+      switch (item.stmt.type) {
+      case StmtType::Pass:
+        break;
+      case StmtType::Expr:
+      case StmtType::Return:
+        valid = exprs_valid(item.stmt.a, item.length);
+        break;
+      case StmtType::Assign:
+        valid = exprs_valid(item.stmt.a, item.length) &&
+                exprs_valid(item.stmt.b, item.length);
+        break;
+      case StmtType::Def:
+        valid = def_valid(item.stmt.a, item.length, top_length);
+        break;
+      }
+      if (!valid) {
+        return false;
+      }
+    }
+    return true;
+  }
+};
+
+static bool tree_valid(const Program &program) {
+  TreeCheck check(program);
+  for (uint32_t i = 0; i < program.statements.size(); i++) {
+    Span span = program.statement_spans[i];
+    if (!check.statement_valid(program.statements[i], span.end - span.begin)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool AstCache::load(String source, bool defer_bodies, Program &program,
+                    StringInterner &identifiers) {
+  uint64_t source_hash = hash_bytes(source);
+  char path[4096];
+  entry_path(source_hash, defer_bodies, path, sizeof(path));
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    stats.misses++;
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (uint64_t)st.st_size < sizeof(CacheHeader)) {
+    close(fd);
+    stats.misses++;
+    stats.rejected++;
+    return false;
+  }
+  // The mapping is writable, privately, so Ident nodes can be renumbered in
+  // place below.
+  uint64_t file_size = st.st_size;
+  void *mapping =
+      mmap(nullptr, file_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    stats.misses++;
+    return false;
+  }
+
+  madvise(mapping, file_size, MADV_SEQUENTIAL);
+  char *base = (char *)mapping;
+  const CacheHeader &header = *(const CacheHeader *)base;
+  bool valid =
+      memcmp(header.magic, cache_magic, sizeof(cache_magic)) == 0 &&
+      header.version == AST_CACHE_VERSION &&
+      header.header_size == sizeof(CacheHeader) &&
+      header.file_size == file_size && header.source_hash == source_hash &&
+      header.source_size == source.size() &&
+      header.defer_bodies == (uint32_t)defer_bodies &&
+      section_valid(header, header.exprs, sizeof(Expr)) &&
+      section_valid(header, header.expr_spans, sizeof(Span)) &&
+      section_valid(header, header.extra, sizeof(uint32_t)) &&
+      section_valid(header, header.statements, sizeof(Stmt)) &&
+      section_valid(header, header.statement_spans, sizeof(Span)) &&
+      section_valid(header, header.functions, sizeof(Function)) &&
+      section_valid(header, header.body_statements, sizeof(Stmt)) &&
+      section_valid(header, header.body_statement_spans, sizeof(Span)) &&
+      section_valid(header, header.identifier_ends, sizeof(uint32_t)) &&
+      section_valid(header, header.identifier_bytes, 1) &&
+      header.exprs.size / sizeof(Expr) ==
+          header.expr_spans.size / sizeof(Span) &&
+      header.statements.size / sizeof(Stmt) ==
+          header.statement_spans.size / sizeof(Span) &&
+      header.body_statements.size / sizeof(Stmt) ==
+          header.body_statement_spans.size / sizeof(Span);
+
+  // Identifier ends have to be increasing and inside identifier_bytes.
+  const uint32_t *ends =
+      (const uint32_t *)(base + header.identifier_ends.offset);
+  uint32_t identifier_count = header.identifier_ends.size / sizeof(uint32_t);
+  for (uint32_t i = 0, previous = 0; valid && i < identifier_count; i++) {
+    valid = ends[i] >= previous && ends[i] <= header.identifier_bytes.size;
+    previous = ends[i];
+  }
+  NodeCounts counts = {(uint32_t)(header.exprs.size / sizeof(Expr)),
+                       (uint32_t)(header.extra.size / sizeof(uint32_t)),
+                       (uint32_t)(header.functions.size / sizeof(Function)),
+                       (uint32_t)(header.body_statements.size / sizeof(Stmt))};
+  const Expr *exprs = (const Expr *)(base + header.exprs.offset);
+  const uint32_t *extra = (const uint32_t *)(base + header.extra.offset);
+  const Stmt *body_statements =
+      (const Stmt *)(base + header.body_statements.offset);
+  uint32_t previous_end = 0;
+  valid = valid &&
+          borrow_section(base, header.exprs, program.exprs,
+                         [&](const Expr &expr, uint32_t idx) {
+                           return expr_valid(expr, idx, exprs, extra, counts,
+                                             identifier_count);
+                         }) &&
+          borrow_section(base, header.expr_spans, program.expr_spans,
+                         [](const Span &, uint32_t) { return true; }) &&
+          borrow_section(base, header.extra, program.extra,
+                         [&](uint32_t expr, uint32_t) {
+                           return expr < counts.exprs;
+                         }) &&
+          borrow_section(base, header.statements, program.statements,
+                         [&](const Stmt &stmt, uint32_t) {
+                           return stmt_valid(stmt, counts);
+                         }) &&
+          borrow_section(base, header.statement_spans,
+                         program.statement_spans,
+                         [&](const Span &span, uint32_t) {
+                           bool ordered = previous_end <= span.begin &&
+                                          span.begin <= span.end &&
+                                          span.end <= source.size();
+                           previous_end = span.end;
+                           return ordered;
+                         }) &&
+          borrow_section(base, header.functions, program.functions,
+                         [&](const Function &function, uint32_t idx) {
+                           return function_valid(function, idx,
+                                                 body_statements, counts);
+                         }) &&
+          borrow_section(base, header.body_statements,
+                         program.body_statements,
+                         [&](const Stmt &stmt, uint32_t) {
+                           return stmt_valid(stmt, counts);
+                         }) &&
+          borrow_section(base, header.body_statement_spans,
+                         program.body_statement_spans,
+                         [](const Span &, uint32_t) { return true; }) &&
+          tree_valid(program);
+  if (!valid) {
+    program = Program();
+    munmap(mapping, file_size);
+    stats.misses++;
+    stats.rejected++;
+    return false;
+  }
+
+  // The keys aren't copied; they stay in the mapping. With a fresh interner
+  // the ids come out the same and the nodes can be used as they are.
+  const char *bytes = base + header.identifier_bytes.offset;
+  std::vector<uint32_t> identifier_map(identifier_count);
+  bool same_ids = true;
+  for (uint32_t i = 0, begin = 0; i < identifier_count; begin = ends[i++]) {
+    String identifier = String{bytes + begin, bytes + ends[i]};
+    identifier_map[i] =
+        identifiers.intern(identifier, hash_string(identifier), false);
+    same_ids = same_ids && identifier_map[i] == i;
+  }
+  if (!same_ids) {
+    for (Expr &expr : program.exprs) {
+      if (expr.type == ExprType::Ident) {
+        expr.a = identifier_map[expr.a];
+      }
+    }
+  }
+
+  mappings.push_back(Mapping{mapping, file_size});
+  stats.hits++;
+  return true;
+}
+
+void AstCache::free() {
+  for (Mapping mapping : mappings) {
+    munmap(mapping.data, mapping.size);
+  }
+  mappings.clear();
+}
+
+static uint64_t align8(uint64_t offset) { return (offset + 7) & ~7ull; }
+
+template <class T>
+static CacheSection add_section(std::vector<char> &out, const T *data,
+                                uint64_t count) {
+  out.resize(align8(out.size()));
+  CacheSection section{out.size(), count * sizeof(T)};
+  out.insert(out.end(), (const char *)data, (const char *)(data + count));
+  return section;
+}
+
+bool AstCache::store(String source, bool defer_bodies,
+                     const Program &program, StringInterner &identifiers) {
+  CacheHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, cache_magic, sizeof(cache_magic));
+  header.version = AST_CACHE_VERSION;
+  header.header_size = sizeof(CacheHeader);
+  header.source_hash = hash_bytes(source);
+  header.source_size = source.size();
+  header.defer_bodies = defer_bodies;
+
+  std::vector<uint32_t> ends;
+  std::vector<char> bytes;
+  for (uint32_t i = 0; i < identifiers.size(); i++) {
+    String identifier = identifiers.get(i);
+    bytes.insert(bytes.end(), identifier.begin, identifier.end);
+    ends.push_back(bytes.size());
+  }
+
+  std::vector<char> out(sizeof(CacheHeader));
+  header.exprs = add_section(out, program.exprs.data(), program.exprs.size());
+  header.expr_spans =
+      add_section(out, program.expr_spans.data(), program.expr_spans.size());
+  header.extra = add_section(out, program.extra.data(), program.extra.size());
+  header.statements =
+      add_section(out, program.statements.data(), program.statements.size());
+  header.statement_spans = add_section(out, program.statement_spans.data(),
+                                       program.statement_spans.size());
+  header.functions =
+      add_section(out, program.functions.data(), program.functions.size());
+  header.body_statements = add_section(out, program.body_statements.data(),
+                                       program.body_statements.size());
+  header.body_statement_spans =
+      add_section(out, program.body_statement_spans.data(),
+                  program.body_statement_spans.size());
+  header.identifier_ends = add_section(out, ends.data(), ends.size());
+  header.identifier_bytes = add_section(out, bytes.data(), bytes.size());
+  header.file_size = out.size();
+  memcpy(out.data(), &header, sizeof(header));
+
+  char path[4096], temporary[4096 + 32];
+  entry_path(header.source_hash, defer_bodies, path, sizeof(path));
+  snprintf(temporary, sizeof(temporary), "%s.%d.tmp", path, (int)getpid());
+  int fd = open(temporary, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return false;
+  }
+  uint64_t written = 0;
+  while (written < out.size()) {
+    ssize_t count = write(fd, out.data() + written, out.size() - written);
+    if (count <= 0) {
+      break;
+    }
+    written += count;
+  }
+  bool complete = close(fd) == 0 && written == out.size();
+  if (!complete || rename(temporary, path) != 0) {
+    unlink(temporary);
+    return false;
+  }
+  stats.stores++;
+  return true;
+}
+
+std::ostream &operator<<(std::ostream &os, const AstCache::Stats &stats) {
+  uint32_t lookups = stats.hits + stats.misses;
+  os << "ast cache: " << stats.hits << " hits, " << stats.misses
+     << " misses (" << stats.rejected << " rejected), " << stats.stores
+     << " stores";
+  if (lookups > 0) {
+    os << ", hit rate " << 100.0 * stats.hits / lookups << "%";
+  }
+  return os;
+}
@@ -0,0 +1,96 @@
+#pragma once
+#include "interner.h"
+#include "syntax_tree.h"
+#include <ostream>
+#include <vector>
+
+// Bump whenever the layout of the file or of the node structs changes.
+#define AST_CACHE_VERSION 3
+
+// A byte range of a cache file, relative to its start.
+struct CacheSection {
+  uint64_t offset;
+  uint64_t size;
+};
+
+// A cache file is this header followed by the sections it points to, each
+// 8 byte aligned. Nothing in it is a pointer: nodes refer to each other by
+// index, and identifiers are stored as their text in id order, as the end
+// offset of each one in `identifier_bytes`.
+struct CacheHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t header_size;
+  uint64_t source_hash;
+  uint64_t source_size;
+  uint64_t file_size;
+  // Whether the parser left def bodies unparsed; see Parser::defer_bodies.
+  uint32_t defer_bodies;
+  uint32_t padding;
+  CacheSection exprs;
+  CacheSection expr_spans;
+  CacheSection extra;
+  CacheSection statements;
+  CacheSection statement_spans;
+  CacheSection functions;
+  CacheSection body_statements;
+  CacheSection body_statement_spans;
+  CacheSection identifier_ends;
+  CacheSection identifier_bytes;
+};
+
+// Parsed programs stored in `directory`, one file per source and parser
+// mode, named after the hash of the source's contents and whether bodies
+// were deferred. An entry is only used if its header checks out: magic,
+// version, the source's hash and size, the mode, and every section
+// inside the file with a whole number of elements. Then every index in the
+// nodes has to be inside the array it points into, and every span inside the
+// statement it's relative to.
+//
+// A loaded program isn't copied out of the file: its arrays borrow a private
+// mapping of it, and the interned identifiers point into it too, so the
+// mapping stays until free().
+// This is a pass-by-reference/pointer datastructure.
+struct AstCache {
+  struct Stats {
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t rejected; // misses where a file was there but didn't check out
+    uint32_t stores;
+  };
+
+  struct Mapping {
+    void *data;
+    uint64_t size;
+  };
+
+  const char *directory;
+  Stats stats = {};
+  std::vector<Mapping> mappings; // one per hit
+
+  explicit AstCache(const char *directory) : directory(directory) {}
+  AstCache &operator=(const AstCache &) = delete;
+  AstCache(AstCache &other) = delete;
+  AstCache(AstCache &&other) = delete;
+  ~AstCache() = default;
+
+  // Fills the empty `program` from the entry for `source` parsed with
+  // `defer_bodies`, and interns its identifiers into `identifiers`, mapping
+  // the Ident nodes if the ids come out different. Returns false if there is
+  // no usable entry. The program's arrays and the identifiers' text point
+  // into the entry's mapping, so they can only be used until free().
+  bool load(String source, bool defer_bodies, Program &program,
+            StringInterner &identifiers);
+  // Writes the entry for `source`. The file is written under a temporary
+  // name and renamed into place, so readers never see half of one.
+  bool store(String source, bool defer_bodies, const Program &program,
+             StringInterner &identifiers);
+
+  // Unmaps every entry loaded so far.
+  void free();
+
+  void entry_path(uint64_t source_hash, bool defer_bodies, char *path,
+                  uint64_t size);
+};
+
+std::ostream &operator<<(std::ostream &os, const AstCache::Stats &stats);
@@ -0,0 +1,323 @@
+#pragma once
+#include "util.h"
+#include <cstdint>
+#include <utility>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define HASH_GROUP_SIZE 16
+#define HASH_CTRL_EMPTY 0x80
+#define HASH_CTRL_DELETED 0xFE
+
+// Bit i is set if control byte i of the group is `byte`.
+inline uint32_t hash_match_byte(const uint8_t *group, uint8_t byte) {
+#ifdef __SSE2__
+  __m128i ctrl = _mm_load_si128((const __m128i *)group);
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(byte)));
+#else
+  uint32_t mask = 0;
+  for (uint32_t i = 0; i < HASH_GROUP_SIZE; i++) {
+    mask |= (uint32_t)(group[i] == byte) << i;
+  }
+  return mask;
+#endif
+}
+
+// Empty and deleted are the control bytes with the high bit set.
+inline uint32_t hash_match_free(const uint8_t *group) {
+#ifdef __SSE2__
+  return _mm_movemask_epi8(_mm_load_si128((const __m128i *)group));
+#else
+  uint32_t mask = 0;
+  for (uint32_t i = 0; i < HASH_GROUP_SIZE; i++) {
+    mask |= (uint32_t)(group[i] >> 7) << i;
+  }
+  return mask;
+#endif
+}
+
+// A HashFn has hash(), whose low 7 bits go in the control byte and the rest
+// pick the first group, and equal(). With `cached` set, every slot keeps
+// its key's hash, so a lookup only calls equal() when the whole hash
+// matches, and growing doesn't hash the keys again; that's worth it for
+// keys that are slow to hash or compare.
+struct IntHash {
+  static constexpr bool cached = false;
+  static uint32_t hash(uint32_t key) {
+    uint64_t hash = key * 0x9e3779b97f4a7c15;
+    return (uint32_t)(hash ^ (hash >> 32));
+  }
+  static bool equal(uint32_t a, uint32_t b) { return a == b; }
+};
+
+template <class K, class V, bool cached> struct HashSlot {
+  K key;
+  V value;
+};
+
+template <class K, class V> struct HashSlot<K, V, true> {
+  K key;
+  uint32_t hash;
+  V value;
+};
+
+// Open addressing in the style of Swiss tables. Slots come in groups of
+// HASH_GROUP_SIZE, and each has a control byte: empty, deleted, or 7 bits
+// of the key's hash. A probe compares a whole group's control bytes at once
+// and only looks at the keys whose bits match. Keys and values are stored
+// together in the slots, and are copied around as bytes. A pointer to a
+// value is valid until the next insert.
+//
+// A table that grows gives its old storage back to the arena with
+// free_block(), and one that fills up mostly with tombstones clears them in
+// place instead of growing, so a table under churn stays the same size.
+template <class K, class V, class HashFn = IntHash> struct Hash {
+  typedef HashSlot<K, V, HashFn::cached> Slot;
+  static_assert(alignof(Slot) <= BUCKET_ALIGNMENT,
+                "slots are only aligned like the arena");
+
+  uint32_t capa; // slots, a power of 2
+  uint32_t size;
+  uint32_t deleted;
+  uint8_t *ctrl;
+  Slot *slots;
+  BucketArray *buckets;
+
+  Hash(BucketArray *_buckets, uint32_t size = 0) : buckets(_buckets) {
+    allocate(capacity_for(size));
+  }
+
+  V *find(const K &key) { return find(key, HashFn::hash(key)); }
+  V *find(const K &key, uint32_t hash) {
+    Slot *slot = find_slot(key, hash);
+    return slot == nullptr ? nullptr : &slot->value;
+  }
+
+  // The value for `key`, added if it isn't there.
+  V *insert(const K &key) { return insert(key, HashFn::hash(key)); }
+  V *insert(const K &key, uint32_t hash) {
+    Slot *slot = find_slot(key, hash);
+    return slot == nullptr ? add(key, hash) : &slot->value;
+  }
+
+  // Adds a key that isn't in the table.
+  V *add(const K &key, uint32_t hash) {
+    if ((uint64_t)(size + deleted + 1) * 8 > (uint64_t)capa * 7) {
+      // When it's mostly tombstones, clearing them makes enough room.
+      if ((uint64_t)(size + 1) * 16 <= (uint64_t)capa * 7) {
+        drop_tombstones();
+      } else {
+        resize(capa * 2);
+      }
+    }
+    uint32_t idx = free_slot(hash);
+    if (ctrl[idx] == HASH_CTRL_DELETED) {
+      deleted--;
+    }
+    ctrl[idx] = hash & 0x7f;
+    set_key(slots[idx], key, hash);
+    size++;
+    return &slots[idx].value;
+  }
+
+  // A group with an empty slot has never been full, so no probe has gone
+  // past it, and the removed slot can go back to empty. Otherwise it has to
+  // stay a tombstone so probes continue through it.
+  V *remove(const K &key) {
+    Slot *slot = find_slot(key, HashFn::hash(key));
+    if (slot == nullptr) {
+      return nullptr;
+    }
+
+    uint32_t idx = slot - slots;
+    if (hash_match_byte(ctrl + group_begin(idx), HASH_CTRL_EMPTY) != 0) {
+      ctrl[idx] = HASH_CTRL_EMPTY;
+    } else {
+      ctrl[idx] = HASH_CTRL_DELETED;
+      deleted++;
+    }
+    size--;
+    return &slot->value;
+  }
+
+  // Makes room for `count` keys in all, so inserting them doesn't grow the
+  // table.
+  void reserve(uint32_t count) {
+    uint32_t capa = capacity_for(count);
+    if (capa > this->capa) {
+      resize(capa);
+    }
+  }
+
+  // Gives the table's storage back to the arena.
+  void free() {
+    buckets->free_block((char *)ctrl, table_bytes(capa));
+    ctrl = nullptr;
+    slots = nullptr;
+    capa = size = deleted = 0;
+  }
+
+  void prefetch(uint32_t hash) const {
+    uint32_t group = first_group(hash);
+    __builtin_prefetch(ctrl + group * HASH_GROUP_SIZE);
+    __builtin_prefetch(slots + group * HASH_GROUP_SIZE);
+  }
+
+  // How many groups the probe for the key in `idx` went through first.
+  uint32_t probe_length(uint32_t idx) const {
+    uint32_t group_mask = capa / HASH_GROUP_SIZE - 1;
+    uint32_t group = first_group(slot_hash(slots[idx]));
+    uint32_t length = 0;
+    for (; group != idx / HASH_GROUP_SIZE; length++) {
+      group = (group + length + 1) & group_mask;
+    }
+    return length;
+  }
+
+  uint64_t bytes() const { return table_bytes(capa); }
+
+  // Room for `size` keys below the maximum load of 7/8.
+  static uint32_t capacity_for(uint32_t size) {
+    uint32_t capa = HASH_GROUP_SIZE;
+    while (capa - capa / 8 <= size) {
+      capa *= 2;
+    }
+    return capa;
+  }
+
+  static uint64_t table_bytes(uint32_t capa) {
+    return capa * (1 + (uint64_t)sizeof(Slot));
+  }
+
+  static uint32_t group_begin(uint32_t idx) {
+    return idx / HASH_GROUP_SIZE * HASH_GROUP_SIZE;
+  }
+
+  uint32_t first_group(uint32_t hash) const {
+    return (hash >> 7) & (capa / HASH_GROUP_SIZE - 1);
+  }
+
+  static uint32_t slot_hash(const Slot &slot) {
+    if constexpr (HashFn::cached) {
+      return slot.hash;
+    } else {
+      return HashFn::hash(slot.key);
+    }
+  }
+
+  static void set_key(Slot &slot, const K &key, uint32_t hash) {
+    slot.key = key;
+    if constexpr (HashFn::cached) {
+      slot.hash = hash;
+    }
+  }
+
+  static bool matches(const Slot &slot, const K &key, uint32_t hash) {
+    if constexpr (HashFn::cached) {
+      return slot.hash == hash && HashFn::equal(slot.key, key);
+    } else {
+      return HashFn::equal(slot.key, key);
+    }
+  }
+
+  void allocate(uint32_t capa) {
+    this->capa = capa;
+    this->size = 0;
+    this->deleted = 0;
+    this->ctrl = (uint8_t *)buckets->add_block(table_bytes(capa));
+    this->slots = (Slot *)(this->ctrl + capa);
+    memset(this->ctrl, HASH_CTRL_EMPTY, capa);
+  }
+
+  // Groups are probed in triangular steps, which visits every group since
+  // their count is a power of 2. The load limit leaves empty slots, so a
+  // probe always ends.
+  Slot *find_slot(const K &key, uint32_t hash) {
+    uint32_t group_mask = capa / HASH_GROUP_SIZE - 1;
+    uint32_t group = first_group(hash);
+    for (uint32_t step = 1;; step++) {
+      const uint8_t *ctrl_group = ctrl + group * HASH_GROUP_SIZE;
+      // The slot a match points at is likely in these lines, so fetch them
+      // while the control bytes load.
+      __builtin_prefetch(slots + group * HASH_GROUP_SIZE);
+      __builtin_prefetch((char *)(slots + group * HASH_GROUP_SIZE) + 64);
+      for (uint32_t match = hash_match_byte(ctrl_group, hash & 0x7f);
+           match != 0; match &= match - 1) {
+        Slot *slot = slots + group * HASH_GROUP_SIZE + __builtin_ctz(match);
+        if (matches(*slot, key, hash)) {
+          return slot;
+        }
+      }
+      if (hash_match_byte(ctrl_group, HASH_CTRL_EMPTY) != 0) {
+        return nullptr;
+      }
+      group = (group + step) & group_mask;
+    }
+  }
+
+  uint32_t free_slot(uint32_t hash) const {
+    uint32_t group_mask = capa / HASH_GROUP_SIZE - 1;
+    uint32_t group = first_group(hash);
+    for (uint32_t step = 1;; step++) {
+      uint32_t match = hash_match_free(ctrl + group * HASH_GROUP_SIZE);
+      if (match != 0) {
+        return group * HASH_GROUP_SIZE + __builtin_ctz(match);
+      }
+      group = (group + step) & group_mask;
+    }
+  }
+
+  // Moves the entries to a new table, and gives the old one back to the
+  // arena for the next table of that size.
+  void resize(uint32_t new_capa) {
+    uint8_t *old_ctrl = ctrl;
+    Slot *old_slots = slots;
+    uint32_t old_capa = capa, old_size = size;
+    allocate(new_capa);
+    for (uint32_t i = 0; i < old_capa; i++) {
+      if (old_ctrl[i] < HASH_CTRL_EMPTY) {
+        uint32_t idx = free_slot(slot_hash(old_slots[i]));
+        ctrl[idx] = old_ctrl[i];
+        slots[idx] = old_slots[i];
+      }
+    }
+    size = old_size;
+    buckets->free_block((char *)old_ctrl, table_bytes(old_capa));
+  }
+
+  // Clears the tombstones without a new table. Every entry is marked
+  // deleted, then moved to the first free slot of its probe, trading places
+  // with an entry that's still marked if that's where it lands. A group
+  // probes have gone past is full of entries already placed, so the rules
+  // remove relies on still hold.
+  void drop_tombstones() {
+    for (uint32_t i = 0; i < capa; i++) {
+      ctrl[i] = ctrl[i] < HASH_CTRL_EMPTY ? HASH_CTRL_DELETED : HASH_CTRL_EMPTY;
+    }
+
+    for (uint32_t i = 0; i < capa; i++) {
+      if (ctrl[i] != HASH_CTRL_DELETED) {
+        continue;
+      }
+      uint32_t hash = slot_hash(slots[i]);
+      uint32_t idx = free_slot(hash);
+      if (idx / HASH_GROUP_SIZE == i / HASH_GROUP_SIZE) {
+        ctrl[i] = hash & 0x7f;
+        continue;
+      }
+
+      if (ctrl[idx] == HASH_CTRL_EMPTY) {
+        slots[idx] = slots[i];
+        ctrl[i] = HASH_CTRL_EMPTY;
+      } else {
+        // Look at what was swapped into i again.
+        std::swap(slots[idx], slots[i]);
+        i--;
+      }
+      ctrl[idx] = hash & 0x7f;
+    }
+    deleted = 0;
+  }
+};
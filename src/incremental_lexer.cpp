@@ -0,0 +1,167 @@
+#include "incremental_lexer.h"
+#include <assert.h>
+#include <cstring>
+
+#define LEX_CHECKPOINT_INTERVAL 32
+
+static void start_segment(std::vector<LexSegment> &segments,
+                          const Lexer &lexer, uint32_t token) {
+  segments.emplace_back();
+  LexSegment &segment = segments.back();
+  segment.offset = lexer.index;
+  segment.token = token;
+  segment.indentation_stack = lexer.indentation_stack;
+}
+
+// Moves a segment across the gap: offsets counted from the start of the text
+// and the stream become offsets counted back from their ends, and the other
+// way around.
+static void flip_segment(LexSegment &segment, uint32_t text_size,
+                         uint32_t token_count) {
+  segment.offset = text_size - segment.offset;
+  segment.token = token_count - segment.token;
+}
+
+IncrementalLexer::IncrementalLexer(BucketArray *buckets, String data)
+    : lexer(buckets, data) {
+  relex(UINT64_MAX);
+}
+
+// Lexes from the lexer's current position, the start of a line, into new
+// segments at the end of `before`, dropping the old segments in `after` that
+// it passes. Once the lexer is at or past `sync_after`, every line start is
+// compared against the next old segment: if it starts there with the same
+// indentation stack, it and the ones after it are still valid, and lexing
+// stops.
+void IncrementalLexer::relex(uint64_t sync_after) {
+  uint32_t text_size = lexer.data.size();
+  const char *base = lexer.data.begin;
+  uint32_t token = before.empty()
+                       ? 0
+                       : before.back().token + before.back().tokens.size();
+  start_segment(before, lexer, token);
+  lexer.errors.clear();
+
+  uint32_t lines = 0;
+  Token tok;
+  while (true) {
+    lexer.next(tok);
+    LexSegment &segment = before.back();
+    const char *segment_base = base + segment.offset;
+    SegmentToken stored;
+    stored.type = tok.type;
+    stored.begin = tok.view.begin - segment_base;
+    stored.end = tok.view.end - segment_base;
+    stored.integer_value = tok.integer_value;
+    segment.tokens.push_back(stored);
+    token_count++;
+    for (const Lexer::LexError &error : lexer.errors) {
+      segment.errors.push_back(
+          SegmentError{(uint32_t)(error.location.begin - segment_base),
+                       (uint32_t)(error.location.end - segment_base),
+                       error.message});
+    }
+    lexer.errors.clear();
+
+    if (tok.type == TokenType::END) {
+      for (const LexSegment &old : after) {
+        token_count -= old.tokens.size();
+      }
+      after.clear();
+      return;
+    }
+    // NEWLINE tokens only come out at depth 0, right before a line start.
+    if (tok.type != TokenType::NEWLINE) {
+      continue;
+    }
+
+    while (!after.empty() && text_size - after.back().offset < lexer.index) {
+      token_count -= after.back().tokens.size();
+      after.pop_back();
+    }
+    if (lexer.index >= sync_after && !after.empty() &&
+        text_size - after.back().offset == lexer.index &&
+        after.back().indentation_stack == lexer.indentation_stack) {
+      return;
+    }
+
+    if (++lines % LEX_CHECKPOINT_INTERVAL == 0) {
+      start_segment(before, lexer, segment.token + segment.tokens.size());
+    }
+  }
+}
+
+void IncrementalLexer::apply_edit(String data, const TextEdit &edit) {
+  uint64_t inserted = edit.inserted.end - edit.inserted.begin;
+  assert(memcmp(data.begin + edit.offset, edit.inserted.begin, inserted) == 0);
+
+  // Move the gap to the segment the edit starts in, in the old text's
+  // coordinates. The first segment starts at 0, so `before` never runs out.
+  // The NEWLINE in front of that segment ends before the edit, so it can't
+  // have been changed by it.
+  uint32_t old_size = lexer.data.size();
+  while (before.back().offset > edit.offset) {
+    after.push_back(std::move(before.back()));
+    before.pop_back();
+    flip_segment(after.back(), old_size, token_count);
+  }
+  while (!after.empty() && old_size - after.back().offset <= edit.offset) {
+    before.push_back(std::move(after.back()));
+    after.pop_back();
+    flip_segment(before.back(), old_size, token_count);
+  }
+
+  LexSegment from = std::move(before.back());
+  before.pop_back();
+  token_count -= from.tokens.size();
+
+  lexer.data = data;
+  lexer.index = from.offset;
+  lexer.state = LexerState::INDENTATION;
+  lexer.parentheses_count = 0;
+  lexer.indentation_stack = std::move(from.indentation_stack);
+  relex(edit.offset + inserted);
+
+  // Leave the lexer where a full lex would have left it.
+  lexer.index = lexer.data.size();
+  lexer.state = LexerState::END;
+  lexer.indentation_stack.resize(1);
+}
+
+// Calls `f(segment, base)` on every segment in order, `base` being where the
+// segment starts in the current text.
+template <class F>
+static void for_each_segment(const IncrementalLexer &incremental, F f) {
+  String data = incremental.lexer.data;
+  for (const LexSegment &segment : incremental.before) {
+    f(segment, data.begin + segment.offset);
+  }
+  for (uint32_t i = incremental.after.size(); i-- > 0;) {
+    const LexSegment &segment = incremental.after[i];
+    f(segment, data.begin + data.size() - segment.offset);
+  }
+}
+
+void IncrementalLexer::copy_tokens(std::vector<Token> &out) const {
+  out.clear();
+  out.reserve(token_count);
+  for_each_segment(*this, [&](const LexSegment &segment, const char *base) {
+    for (const SegmentToken &stored : segment.tokens) {
+      Token tok;
+      tok.type = stored.type;
+      tok.view = String{base + stored.begin, base + stored.end};
+      tok.integer_value = stored.integer_value;
+      out.push_back(tok);
+    }
+  });
+}
+
+void IncrementalLexer::copy_errors(std::vector<Lexer::LexError> &out) const {
+  out.clear();
+  for_each_segment(*this, [&](const LexSegment &segment, const char *base) {
+    for (const SegmentError &error : segment.errors) {
+      out.push_back(Lexer::LexError{
+          String{base + error.begin, base + error.end}, error.message});
+    }
+  });
+}
@@ -0,0 +1,82 @@
+#pragma once
+#include "lexer.h"
+#include <vector>
+
+// Replace `removed` bytes at `offset` with `inserted`.
+struct TextEdit {
+  uint64_t offset;
+  uint64_t removed;
+  String inserted;
+};
+
+// A token as a segment keeps it: its view is a range of offsets from the
+// start of the segment.
+struct SegmentToken {
+  TokenType type;
+  uint32_t begin, end;
+  union {
+    double floating_value;
+    uint64_t integer_value;
+    uint32_t identifier_idx;
+  };
+};
+
+struct SegmentError {
+  uint32_t begin, end;
+  const char *message;
+};
+
+// The tokens, and the lex errors, of the lines from one point where lexing
+// can restart to the next: the start of a logical line (state INDENTATION,
+// no open parentheses), along with the indentation stack there. Everything
+// in it is relative to its start, so it stays valid wherever its lines move.
+struct LexSegment {
+  // Where the segment starts, as a byte offset and a token index; see
+  // IncrementalLexer for what they're counted from.
+  uint32_t offset;
+  uint32_t token;
+  std::vector<uint32_t> indentation_stack;
+  std::vector<SegmentToken> tokens;
+  std::vector<SegmentError> errors;
+};
+
+// Keeps a token stream up to date while the text it came from is edited.
+//
+// The stream is cut into segments of LEX_CHECKPOINT_INTERVAL logical lines.
+// An edit re-lexes from the start of the segment it's in, and stops at the
+// first old segment after it where the lexer's state matches again; the new
+// segments replace the ones in between.
+//
+// The segments are kept in a gap buffer split at the last edit: `before` is
+// in order, with offsets counted from the start of the text and the stream,
+// and `after` is in reverse order, with offsets counted back from their
+// ends. Neither side changes when the text in the gap does, so an edit only
+// touches the segments it re-lexes, and the ones between it and the
+// previous edit, which move across the gap one small step each.
+//
+// Identifier ids stay stable across edits; ids of identifiers that are no
+// longer used are simply never referenced again.
+// This is a pass-by-reference/pointer datastructure.
+struct IncrementalLexer {
+  Lexer lexer;
+  std::vector<LexSegment> before, after;
+  uint32_t token_count = 0;
+
+  IncrementalLexer(BucketArray *buckets, String data);
+  IncrementalLexer &operator=(const IncrementalLexer &) = delete;
+  IncrementalLexer(IncrementalLexer &other) = delete;
+  IncrementalLexer(IncrementalLexer &&other) = delete;
+  ~IncrementalLexer() = default;
+
+  // `data` is the full text after the edit, padded like a SourceFile; the
+  // previous text has to stay alive until this returns.
+  void apply_edit(String data, const TextEdit &edit);
+
+  // The whole stream, and its errors, pointing into the current text.
+  void copy_tokens(std::vector<Token> &out) const;
+  void copy_errors(std::vector<Lexer::LexError> &out) const;
+
+  uint32_t segment_count() const { return before.size() + after.size(); }
+
+  void relex(uint64_t sync_after);
+};
@@ -0,0 +1,155 @@
+#include "incremental_parser.h"
+#include <algorithm>
+
+IncrementalParser::IncrementalParser(BucketArray *buckets, String data)
+    : parser(buckets, data) {
+  parser.program = &program;
+  reparse(data);
+}
+
+bool IncrementalParser::reparse(String data) {
+  program = Program();
+  line_starts.assign(1, 0);
+  statement_nodes.clear();
+  garbage_exprs = 0;
+  program.exprs.reserve(data.size() / 4);
+  program.expr_spans.reserve(data.size() / 4);
+  return reparse_from(data, 0, UINT64_MAX, 0);
+}
+
+bool IncrementalParser::apply_edit(String data, const TextEdit &edit) {
+  if (!parsed) {
+    return reparse(data);
+  }
+
+  uint64_t inserted = edit.inserted.end - edit.inserted.begin;
+  int64_t shift = (int64_t)inserted - (int64_t)edit.removed;
+  // Last line start before the edit, so that a def whose body ends right
+  // where the edit is gets reparsed too: where its body ends depends on the
+  // indentation of the line after it. Statements before that one can't have
+  // changed.
+  uint32_t first = std::lower_bound(line_starts.begin(), line_starts.end(),
+                                    edit.offset) -
+                   line_starts.begin();
+  if (first > 0) {
+    first--;
+  }
+  return reparse_from(data, first, edit.offset + inserted, shift);
+}
+
+// Replaces items [first, last) with `fresh`. The tail moves at most once,
+// and not at all if the count stays the same.
+template <typename Array, typename T>
+static void splice(Array &items, uint32_t first, uint32_t last,
+                   const std::vector<T> &fresh) {
+  uint32_t size = items.size();
+  int64_t growth = (int64_t)fresh.size() - (int64_t)(last - first);
+  if (growth > 0) {
+    items.resize(size + growth);
+    std::copy_backward(items.begin() + last, items.begin() + size,
+                       items.end());
+  } else if (growth < 0) {
+    std::copy(items.begin() + last, items.end(), items.begin() + last + growth);
+    items.resize(size + growth);
+  }
+  std::copy(fresh.begin(), fresh.end(), items.begin() + first);
+}
+
+// Parses from line_starts[first] on. Once a statement ends at or past
+// `sync_after`, its end is compared against the old line starts, `shift`
+// bytes behind; on a match the old statements from there on are kept.
+bool IncrementalParser::reparse_from(String data, uint32_t first,
+                                     uint64_t sync_after, int64_t shift) {
+  uint32_t old_count = program.statements.size();
+  NodeCounts old_nodes = program.node_counts();
+  parser.restart(data, line_starts[first]);
+
+  std::vector<uint32_t> starts;
+  std::vector<NodeRange> nodes;
+  uint32_t sync = first;
+  bool synced = false;
+  while (parser.peek() != TokenType::END) {
+    starts.push_back(parser.statement_end);
+    NodeRange range;
+    range.begin = program.node_counts();
+    if (!parser.try_parse_statement()) {
+      // Drop what this parse appended, so `program` stays as it was.
+      program.statements.resize(old_count);
+      program.statement_spans.resize(old_count);
+      program.truncate_nodes(old_nodes);
+      parsed = false;
+      return false;
+    }
+    range.end = program.node_counts();
+    nodes.push_back(range);
+
+    if (parser.statement_end < sync_after) {
+      continue;
+    }
+    int64_t old_end = (int64_t)parser.statement_end - shift;
+    for (; sync < line_starts.size() && line_starts[sync] < old_end; sync++)
+      ;
+    if (sync < line_starts.size() && line_starts[sync] == old_end) {
+      synced = true;
+      break;
+    }
+  }
+
+  // The fresh statements were appended after the old ones; move them into
+  // place over statements [first, sync).
+  uint32_t line_sync = sync;
+  if (!synced) {
+    sync = old_count;
+    line_sync = line_starts.size();
+    starts.push_back(parser.statement_end);
+  }
+  for (uint32_t i = line_sync; i < line_starts.size(); i++) {
+    line_starts[i] += shift;
+  }
+  for (uint32_t i = sync; i < old_count; i++) {
+    program.statement_spans[i].begin += shift;
+    program.statement_spans[i].end += shift;
+  }
+  for (uint32_t i = first; i < sync; i++) {
+    garbage_exprs +=
+        statement_nodes[i].end.exprs - statement_nodes[i].begin.exprs;
+  }
+
+  std::vector<Stmt> stmts(program.statements.begin() + old_count,
+                          program.statements.end());
+  std::vector<Span> spans(program.statement_spans.begin() + old_count,
+                          program.statement_spans.end());
+  program.statements.resize(old_count);
+  program.statement_spans.resize(old_count);
+  splice(program.statements, first, sync, stmts);
+  splice(program.statement_spans, first, sync, spans);
+  splice(statement_nodes, first, sync, nodes);
+  splice(line_starts, first, line_sync, starts);
+
+  parsed = true;
+  if (garbage_exprs > program.exprs.size() - garbage_exprs) {
+    compact();
+  }
+  return true;
+}
+
+// Copies the live nodes, statement by statement, into a fresh Program.
+// Bodies parsed by parse_body aren't in any statement's range, so they're
+// dropped and will be parsed again when needed.
+void IncrementalParser::compact() {
+  Program live;
+  live.exprs.reserve(program.exprs.size() - garbage_exprs);
+  live.expr_spans.reserve(program.exprs.size() - garbage_exprs);
+  live.statements = std::move(program.statements);
+  live.statement_spans = std::move(program.statement_spans);
+  for (uint32_t i = 0; i < live.statements.size(); i++) {
+    NodeRange &range = statement_nodes[i];
+    NodeRange moved;
+    moved.begin = live.node_counts();
+    live.statements[i].relocate(live.append_nodes(program, range));
+    moved.end = live.node_counts();
+    range = moved;
+  }
+  program = std::move(live);
+  garbage_exprs = 0;
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include "incremental_lexer.h"
+#include "parser.h"
+#include "syntax_tree.h"
+#include <vector>
+
+// Keeps a Program up to date while the text it came from is edited.
+//
+// Every top-level statement starts on a line where the lexer is in a known
+// state: indentation and parentheses closed. An edit is reparsed from the
+// line of the first statement it touches, and parsing stops at the first
+// statement that ends, after the edit, on an old statement's line start.
+// The old statements from there on are kept as they are, nodes included;
+// only their statement spans move. Expression spans are relative to their
+// statement, so they don't.
+//
+// Nodes of replaced statements are left in place until they outnumber the
+// live ones, and then compacted away.
+// This is a pass-by-reference/pointer datastructure.
+struct IncrementalParser {
+  Parser parser;
+  Program program;
+  // line_starts[i] is where the lines of statement i begin, blank lines in
+  // front of it included. The last entry is where the lines after the last
+  // statement begin.
+  std::vector<uint32_t> line_starts;
+  std::vector<NodeRange> statement_nodes;
+  uint32_t garbage_exprs = 0;
+  // If the last parse failed, the next edit reparses everything.
+  bool parsed = false;
+
+  IncrementalParser(BucketArray *buckets, String data);
+  IncrementalParser &operator=(const IncrementalParser &) = delete;
+  IncrementalParser(IncrementalParser &other) = delete;
+  IncrementalParser(IncrementalParser &&other) = delete;
+  ~IncrementalParser() = default;
+
+  // `data` is the full text after the edit, padded like a SourceFile.
+  // Returns false with parser.error set if the new text doesn't parse.
+  // `program` then still holds only whole statements: those from before the
+  // edit, or none if the edit had to reparse everything.
+  bool apply_edit(String data, const TextEdit &edit);
+  bool reparse(String data);
+
+  bool reparse_from(String data, uint32_t first, uint64_t sync_after,
+                    int64_t shift);
+  void compact();
+};
@@ -0,0 +1,122 @@
+#include "interner.h"
+#include <cstring>
+#include <ostream>
+
+static inline uint64_t load_tail(const char *p, uint64_t len) {
+  uint64_t word = 0;
+  memcpy(&word, p, len);
+  return word;
+}
+
+static inline uint64_t mix(uint64_t a, uint64_t b) {
+  __uint128_t product = (__uint128_t)a * b;
+  return (uint64_t)product ^ (uint64_t)(product >> 64);
+}
+
+// Eight bytes at a time multiply-mix; identifiers are short, so for them
+// this is usually one or two rounds.
+uint64_t hash_bytes(String str) {
+  const char *p = str.begin;
+  uint64_t len = str.end - str.begin;
+  uint64_t h = 0x9e3779b97f4a7c15ull ^ len;
+  for (; len >= 8; p += 8, len -= 8) {
+    uint64_t word;
+    memcpy(&word, p, 8);
+    h = mix(h ^ word, 0xa0761d6478bd642full);
+  }
+  if (len > 0) {
+    h = mix(h ^ load_tail(p, len), 0xe7037ed1a0b428dbull);
+  }
+  return mix(h, 0x8ebc6af09c88c6e3ull);
+}
+
+uint32_t hash_string(String str) {
+  uint64_t h = hash_bytes(str);
+  return (uint32_t)(h ^ (h >> 32));
+}
+
+StringInterner::StringInterner(BucketArray *_buckets, uint32_t count)
+    : buckets(_buckets), table(_buckets, count) {}
+
+String StringInterner::copy_key(String str) {
+  uint64_t len = str.end - str.begin;
+  key_bytes += len;
+  char *key = buckets->add(len, 1);
+  memcpy(key, str.begin, len);
+  return String{key, len};
+}
+
+void StringInterner::reserve(uint32_t count) {
+  table.reserve(count);
+  strings.reserve(count);
+}
+
+uint32_t StringInterner::intern(String str) {
+  return intern(str, hash_string(str));
+}
+
+uint32_t StringInterner::intern(String str, uint32_t hash, bool copy) {
+  uint32_t *id = table.find(str, hash);
+  if (id != nullptr) {
+    return *id;
+  }
+
+  String key = copy ? copy_key(str) : str;
+  id = table.add(key, hash);
+  *id = strings.size();
+  strings.push_back(key);
+  return *id;
+}
+
+// Hashes the whole batch up front and prefetches each first group, so the
+// table misses overlap instead of being paid one lookup at a time.
+void StringInterner::intern_batch(const String *strs, uint32_t *ids,
+                                  uint32_t count) {
+  reserve(strings.size() + count);
+  for (uint32_t i = 0; i < count; i++) {
+    ids[i] = hash_string(strs[i]);
+    table.prefetch(ids[i]);
+  }
+  for (uint32_t i = 0; i < count; i++) {
+    ids[i] = intern(strs[i], ids[i]);
+  }
+}
+
+bool StringInterner::find(String str, uint32_t &id) {
+  uint32_t *found = table.find(str, hash_string(str));
+  if (found == nullptr) {
+    return false;
+  }
+  id = *found;
+  return true;
+}
+
+StringInterner::Stats StringInterner::stats() {
+  Stats stats;
+  stats.count = strings.size();
+  stats.capacity = table.capa;
+  stats.key_bytes = key_bytes;
+  stats.table_bytes = table.bytes() + strings.capacity() * sizeof(String);
+  stats.max_probe = 0;
+
+  uint64_t total_probe = 0;
+  for (uint32_t idx = 0; idx < table.capa; idx++) {
+    if (table.ctrl[idx] >= HASH_CTRL_EMPTY) {
+      continue;
+    }
+    uint32_t probe = table.probe_length(idx);
+    total_probe += probe;
+    if (probe > stats.max_probe) {
+      stats.max_probe = probe;
+    }
+  }
+  stats.mean_probe = stats.count ? (double)total_probe / stats.count : 0;
+  return stats;
+}
+
+std::ostream &operator<<(std::ostream &os, const StringInterner::Stats &stats) {
+  return os << stats.count << " identifiers, capacity " << stats.capacity
+            << ", " << stats.key_bytes << " key bytes, " << stats.table_bytes
+            << " table bytes, probe mean " << stats.mean_probe << " max "
+            << stats.max_probe;
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include "hash.h"
+#include "util.h"
+#include <cstdint>
+#include <vector>
+
+uint64_t hash_bytes(String str);
+uint32_t hash_string(String str);
+
+struct StringHash {
+  static constexpr bool cached = true;
+  static uint32_t hash(const String &str) { return hash_string(str); }
+  static bool equal(const String &a, const String &b) {
+    return a.end - a.begin == b.end - b.begin &&
+           memcmp(a.begin, b.begin, a.end - a.begin) == 0;
+  }
+};
+
+// Maps strings to dense ids, starting at 0, in order of first appearance.
+// Interned strings are copied into BucketArray memory, so they stay valid
+// after the source buffer goes away, and until the BucketArray is freed.
+//
+// The table's slots hold the key with its full hash, so a probe only touches
+// the key bytes on a likely match, and doesn't go through `strings`.
+struct StringInterner {
+  struct Stats {
+    uint32_t count;
+    uint32_t capacity;
+    uint64_t key_bytes;   // bytes of key text copied into the buckets
+    uint64_t table_bytes; // slots plus the id -> string array
+    uint32_t max_probe;   // most groups probed before a key's own
+    double mean_probe;    // average groups probed before a key's own
+  };
+
+  BucketArray *buckets;
+  Hash<String, uint32_t, StringHash> table;
+  std::vector<String> strings;
+  uint64_t key_bytes = 0;
+
+  explicit StringInterner(BucketArray *buckets, uint32_t count = 32);
+
+  uint32_t intern(String str);
+  // With `copy` false, a new key isn't copied, so it has to stay valid as
+  // long as the interner does.
+  uint32_t intern(String str, uint32_t hash, bool copy = true);
+  void intern_batch(const String *strs, uint32_t *ids, uint32_t count);
+  bool find(String str, uint32_t &id);
+
+  String get(uint32_t id) { return strings[id]; }
+  uint32_t size() { return strings.size(); }
+
+  void reserve(uint32_t count);
+  Stats stats();
+
+  String copy_key(String str);
+};
+
+std::ostream &operator<<(std::ostream &os, const StringInterner::Stats &stats);
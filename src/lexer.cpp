@@ -1,5 +1,7 @@
 #include "lexer.h"
-#include <cstdlib>
+#include "number.h"
+#include "scanner.h"
+#include <cstring>
 #include <ostream>
 
 struct Escaped {
@@ -51,7 +53,228 @@ struct Escaped {
   }
 };
 
-Lexer::Lexer(const char *_data) : data(_data) {
+// Keywords are found with a single probe into a perfect hash table that is
+// built at compile time. The hash only looks at the length and the first and
+// last characters, so those have to be unique across keywords; the
+// static_asserts below catch it when a new keyword breaks that.
+struct Keyword {
+  const char *text;
+  TokenType type;
+};
+
+static constexpr Keyword keywords[] = {
+    {"def", TokenType::DEF},         {"pass", TokenType::PASS},
+    {"return", TokenType::RETURN},   {"switch", TokenType::SWITCH},
+    {"case", TokenType::CASE},       {"break", TokenType::BREAK},
+    {"for", TokenType::FOR},         {"while", TokenType::WHILE},
+    {"in", TokenType::IN},           {"is", TokenType::IS},
+    {"class", TokenType::CLASS},     {"raise", TokenType::RAISE},
+    {"yield", TokenType::YIELD},     {"async", TokenType::ASYNC},
+    {"if", TokenType::IF},           {"else", TokenType::ELSE},
+    {"None", TokenType::NONE},       {"int", TokenType::INT_TYPE},
+    {"float", TokenType::FLOAT_TYPE}, {"str", TokenType::STR_TYPE},
+    {"bool", TokenType::BOOL_TYPE},
+};
+
+static constexpr uint32_t KEYWORD_COUNT = sizeof(keywords) / sizeof(Keyword);
+static constexpr uint32_t KEYWORD_TABLE_BITS = 6;
+static constexpr uint32_t KEYWORD_TABLE_SIZE = 1 << KEYWORD_TABLE_BITS;
+static constexpr uint32_t KEYWORD_MAX_LEN = 8;
+
+static constexpr uint32_t keyword_length(const char *text) {
+  uint32_t len = 0;
+  for (; text[len] != '\0'; len++)
+    ;
+  return len;
+}
+
+static constexpr uint32_t keyword_key(const char *text, uint64_t len) {
+  return (uint32_t)(uint8_t)text[0] | (uint32_t)(uint8_t)text[len - 1] << 8 |
+         (uint32_t)len << 16;
+}
+
+static constexpr uint32_t keyword_slot(uint32_t seed, uint32_t key) {
+  return (key * seed) >> (32 - KEYWORD_TABLE_BITS);
+}
+
+static constexpr bool keyword_keys_unique() {
+  for (uint32_t i = 0; i < KEYWORD_COUNT; i++) {
+    const char *a = keywords[i].text;
+    for (uint32_t j = i + 1; j < KEYWORD_COUNT; j++) {
+      const char *b = keywords[j].text;
+      if (keyword_key(a, keyword_length(a)) ==
+          keyword_key(b, keyword_length(b))) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// First odd multiplier in a golden-ratio sequence that sends every keyword to
+// its own slot, or 0.
+static constexpr uint32_t find_keyword_seed() {
+  for (uint32_t n = 1; n < 4096; n++) {
+    uint32_t seed = (2654435761u * n) | 1;
+    uint64_t used = 0;
+    bool ok = true;
+    for (uint32_t i = 0; ok && i < KEYWORD_COUNT; i++) {
+      const char *text = keywords[i].text;
+      uint32_t slot = keyword_slot(seed, keyword_key(text, keyword_length(text)));
+      ok = (used & (1ull << slot)) == 0;
+      used |= 1ull << slot;
+    }
+    if (ok) {
+      return seed;
+    }
+  }
+  return 0;
+}
+
+static constexpr uint32_t KEYWORD_SEED = find_keyword_seed();
+
+struct KeywordTable {
+  struct Slot {
+    char text[KEYWORD_MAX_LEN] = {};
+    uint32_t len = 0;
+    TokenType type = TokenType::IDENT;
+  };
+
+  Slot slots[KEYWORD_TABLE_SIZE];
+
+  constexpr KeywordTable() {
+    for (uint32_t i = 0; i < KEYWORD_COUNT; i++) {
+      const char *text = keywords[i].text;
+      uint32_t len = keyword_length(text);
+      Slot &slot = slots[keyword_slot(KEYWORD_SEED, keyword_key(text, len))];
+      for (uint32_t c = 0; c < len; c++) {
+        slot.text[c] = text[c];
+      }
+      slot.len = len;
+      slot.type = keywords[i].type;
+    }
+  }
+};
+
+static_assert(keyword_keys_unique(),
+              "keywords must differ in length, first or last character");
+static_assert(KEYWORD_SEED != 0, "no perfect hash seed for the keyword table");
+
+static constexpr KeywordTable keyword_table;
+
+static inline bool lookup_keyword(const char *text, uint64_t len,
+                                  TokenType &type) {
+  if (len > KEYWORD_MAX_LEN) {
+    return false;
+  }
+  const KeywordTable::Slot &slot =
+      keyword_table.slots[keyword_slot(KEYWORD_SEED, keyword_key(text, len))];
+  if (slot.len != len || memcmp(slot.text, text, len) != 0) {
+    return false;
+  }
+  type = slot.type;
+  return true;
+}
+
+// Operators and punctuation are lexed by a DFA whose tables are built at
+// compile time from this list, so adding an operator only means adding a
+// line here. `nesting` is how the token changes the bracket depth, inside
+// of which newlines and indentation are ignored.
+struct Operator {
+  const char *text;
+  TokenType type;
+  int8_t nesting;
+};
+
+static constexpr Operator operators[] = {
+    {"(", TokenType::LPAREN, 1},
+    {")", TokenType::RPAREN, -1},
+    {"[", TokenType::LBRACKET, 1},
+    {"]", TokenType::RBRACKET, -1},
+    {",", TokenType::COMMA, 0},
+    {":", TokenType::COLON, 0},
+    {".", TokenType::DOT, 0},
+    {"+", TokenType::PLUS, 0},
+    {"-", TokenType::MINUS, 0},
+    {"->", TokenType::ARROW, 0},
+    {"---", TokenType::TRIPLE_DASH, 0},
+    {"*", TokenType::STAR, 0},
+    {"**", TokenType::STAR_STAR, 0},
+    {"/", TokenType::DIV, 0},
+    {"//", TokenType::DIV_DIV, 0},
+    {"%", TokenType::PERCENT, 0},
+    {"=", TokenType::EQUALS, 0},
+    {"==", TokenType::EQUALS_EQUALS, 0},
+    {"!=", TokenType::NOT_EQUAL, 0},
+    {"<", TokenType::LESS_THAN, 0},
+    {"<=", TokenType::LESS_EQ, 0},
+    {">", TokenType::GREATER_THAN, 0},
+    {">=", TokenType::GREATER_EQ, 0},
+};
+
+static constexpr uint32_t OPERATOR_COUNT = sizeof(operators) / sizeof(Operator);
+
+// Every byte maps to a class; each character that appears in an operator
+// gets a class of its own, numbered from FIRST_OPERATOR_CHAR.
+namespace CharClass {
+enum : uint8_t { OTHER, NEWLINE_CHAR, DIGIT, LETTER, FIRST_OPERATOR_CHAR };
+}
+
+struct LexTable {
+  static constexpr uint32_t MAX_CLASSES = 32;
+  static constexpr uint32_t MAX_STATES = 64;
+  static constexpr uint8_t DEAD = 0;
+  static constexpr uint8_t START = 1;
+
+  uint8_t char_class[256] = {};
+  uint8_t class_count = CharClass::FIRST_OPERATOR_CHAR;
+  uint8_t state_count = START + 1;
+  uint8_t next[MAX_STATES][MAX_CLASSES] = {};
+  // UNKNOWN for states that don't end an operator, the dead state included.
+  TokenType accept[MAX_STATES] = {};
+  int8_t nesting[MAX_STATES] = {};
+
+  constexpr LexTable() {
+    for (uint32_t i = 0; i < MAX_STATES; i++) {
+      accept[i] = TokenType::UNKNOWN;
+    }
+    char_class[(uint8_t)'\r'] = char_class[(uint8_t)'\n'] =
+        CharClass::NEWLINE_CHAR;
+    for (char c = '0'; c <= '9'; c++) {
+      char_class[(uint8_t)c] = CharClass::DIGIT;
+    }
+    for (char c = 'a'; c <= 'z'; c++) {
+      char_class[(uint8_t)c] = char_class[(uint8_t)(c - 'a' + 'A')] =
+          CharClass::LETTER;
+    }
+
+    // The DFA is the trie of the operator list.
+    for (uint32_t i = 0; i < OPERATOR_COUNT; i++) {
+      uint8_t state = START;
+      for (const char *c = operators[i].text; *c != '\0'; c++) {
+        uint8_t &cls = char_class[(uint8_t)*c];
+        if (cls == CharClass::OTHER) {
+          cls = class_count++;
+        }
+        if (next[state][cls] == DEAD) {
+          next[state][cls] = state_count++;
+        }
+        state = next[state][cls];
+      }
+      accept[state] = operators[i].type;
+      nesting[state] = operators[i].nesting;
+    }
+  }
+};
+
+static constexpr LexTable lex_table;
+
+static_assert(lex_table.class_count <= LexTable::MAX_CLASSES &&
+                  lex_table.state_count <= LexTable::MAX_STATES,
+              "operator DFA doesn't fit, raise LexTable's limits");
+
+Lexer::Lexer(BucketArray *buckets, String _data)
+    : data(_data), identifiers(buckets) {
   indentation_stack.reserve(16);
   indentation_stack.push_back(0);
 }
@@ -62,6 +285,12 @@ Token Lexer::next() {
   return tok;
 }
 
+void Lexer::lex_all(std::vector<Token> &tokens) {
+  do
+    tokens.push_back(next());
+  while (tokens.back().type != TokenType::END);
+}
+
 void Lexer::next(Token &tok) {
   if (state == LexerState::DEDENT) {
     next_tok_dedent(tok);
@@ -71,9 +300,11 @@ void Lexer::next(Token &tok) {
     next_tok_indent(tok);
   } else if (state == LexerState::END && indentation_stack.size() > 1) {
     tok.type = TokenType::DEDENT;
+    tok.view = data.substr(index, 0);
     indentation_stack.pop_back();
   } else if (state == LexerState::END) {
     tok.type = TokenType::END;
+    tok.view = data.substr(index, 0);
   }
 }
 
@@ -83,7 +314,7 @@ void Lexer::next_tok_indent(Token &tok) {
   bool done = false;
   int begin = index;
 
-  for (; !done && index < data.size();) {
+  for (; !done;) {
     switch (data.at(index)) {
     case '\\':
       index++;
@@ -119,6 +350,11 @@ void Lexer::next_tok_indent(Token &tok) {
   if (index == data.size()) {
     state = LexerState::END;
     next(tok);
+  } else if (defer_indentation) {
+    tok.type = TokenType::INDENT;
+    state = LexerState::NORMAL;
+    deferred_levels.push_back(indentation_level);
+    tok.view = data.substr(begin, end - begin);
   } else if (indentation_level < previous_indentation) {
     state = LexerState::DEDENT;
     this->indentation_level = indentation_level;
@@ -138,6 +374,7 @@ void Lexer::next_tok_dedent(Token &tok) {
   int previous_indentation = indentation_stack.back();
   if (indentation_level < previous_indentation) {
     indentation_stack.pop_back();
+    tok.view = data.substr(index, 0);
     if (indentation_level > indentation_stack.back()) {
       tok.type = TokenType::UNKNOWN_DEDENT;
       state = LexerState::NORMAL;
@@ -151,48 +388,22 @@ void Lexer::next_tok_dedent(Token &tok) {
   } else {
     state = LexerState::NORMAL;
     tok.type = TokenType::UNKNOWN_DEDENT;
+    tok.view = data.substr(index, 0);
     indentation_stack.push_back(indentation_level);
   }
 }
 
 void Lexer::next_tok_normal(Token &tok) {
-
-  auto advance_single_token = [&tok, this](TokenType token_type) {
-    tok.type = token_type;
-    tok.view = data.substr(index++, 1);
-    if (index == data.size()) {
-      state = LexerState::END;
-    }
-  };
-
-  auto advance_repeated_character = [&tok, this](char repeated_char) {
-    uint64_t char_count = 0;
-    for (int i = index; i < data.size() && data.at(i) == repeated_char;
-         i++, char_count++)
-      ;
-    index += char_count;
-    if (index == data.size()) {
-      state = LexerState::END;
-    }
-    return char_count;
-  };
-
-  bool found_word = false;
-  while (!found_word) {
+  while (true) {
     // Ignore leading whitespace
-    for (const char *c = &data.at(index); index < data.size();) {
-      c = &data.at(index);
-      if (*c == '\\') {
-        index++;
-        handle_newline(tok);
-        if (tok.type == TokenType::UNKNOWN) {
-          tok.view = String{c, 2};
-          return;
-        }
-      } else if (*c == ' ' || *c == '\t')
-        index++;
-      else {
-        break;
+    for (index = scanner.blanks(data.begin, index); data.at(index) == '\\';
+         index = scanner.blanks(data.begin, index)) {
+      const char *c = &data.at(index);
+      index++;
+      handle_newline(tok);
+      if (tok.type == TokenType::UNKNOWN) {
+        tok.view = String{c, 2};
+        return;
       }
     }
 
@@ -202,171 +413,69 @@ void Lexer::next_tok_normal(Token &tok) {
       return;
     }
 
-    switch (data.at(index)) {
-    case '(':
-      advance_single_token(TokenType::LPAREN);
-      parentheses_count++;
-      return;
-    case ')':
-      advance_single_token(TokenType::RPAREN);
-      if (parentheses_count > 0) {
-        parentheses_count--;
-      }
-      return;
-    case '*': {
-      uint64_t start_index = index;
-      uint64_t star_count = advance_repeated_character('*');
-      tok.view = data.substr(start_index, star_count);
-      if (star_count == 1) {
-        tok.type = TokenType::STAR;
-      } else if (star_count == 2) {
-        tok.type = TokenType::STAR_STAR;
-      } else {
-        tok.type = TokenType::UNKNOWN;
-      }
-      return;
-    }
-    case '!': {
-      uint64_t start_index = index++;
-      uint64_t equals_count = advance_repeated_character('=');
-      tok.view = data.substr(start_index, equals_count + 1);
-      if (equals_count == 1) {
-        tok.type = TokenType::NOT_EQUAL;
-      } else {
-        tok.type = TokenType::UNKNOWN;
-      }
-      return;
-    }
-    case '<': {
-      uint64_t start_index = index++;
-      uint64_t equals_count = advance_repeated_character('=');
-      tok.view = data.substr(start_index, equals_count + 1);
-      if (equals_count == 0) {
-        tok.type = TokenType::LESS_THAN;
-      } else if (equals_count == 1) {
-        tok.type = TokenType::LESS_EQ;
-      } else {
-        tok.type = TokenType::UNKNOWN;
-      }
-      return;
-    }
-    case '>': {
-      uint64_t start_index = index++;
-      uint64_t equals_count = advance_repeated_character('=');
-      tok.view = data.substr(start_index, equals_count + 1);
-      if (equals_count == 0) {
-        tok.type = TokenType::GREATER_THAN;
-      } else if (equals_count == 1) {
-        tok.type = TokenType::GREATER_EQ;
-      } else {
-        tok.type = TokenType::UNKNOWN;
-      }
-      return;
-    }
-    case '=': {
-      uint64_t start_index = index;
-      uint64_t equals_count = advance_repeated_character('=');
-      tok.view = data.substr(start_index, equals_count);
-      if (equals_count == 1) {
-        tok.type = TokenType::EQUALS;
-      } else if (equals_count == 2) {
-        tok.type = TokenType::EQUALS_EQUALS;
-      } else {
-        tok.type = TokenType::UNKNOWN;
-      }
-      return;
-    }
-    case '/': {
-      uint64_t start_index = index;
-      uint64_t div_count = advance_repeated_character('%');
-      tok.view = data.substr(start_index, div_count);
-      if (div_count == 1) {
-        tok.type = TokenType::DIV;
-      } else if (div_count == 2) {
-        tok.type = TokenType::DIV_DIV;
-      } else {
-        tok.type = TokenType::UNKNOWN;
-      }
-      return;
-    }
-    case '-': {
-      uint64_t start_index = index;
-      uint64_t minus_count = advance_repeated_character('%');
-      tok.view = data.substr(start_index, minus_count);
-      if (minus_count == 1) {
-        tok.type = TokenType::MINUS;
-      } else if (minus_count == 3) {
-        tok.type = TokenType::TRIPLE_DASH;
-      } else {
-        tok.type = TokenType::UNKNOWN;
-      }
-      return;
-    }
-    case '%':
-      advance_single_token(TokenType::PERCENT);
-      return;
-    case '+':
-      advance_single_token(TokenType::PLUS);
-      return;
-    case ',':
-      advance_single_token(TokenType::COMMA);
-      return;
-    case '\r':
-    case '\n': // Handle newlines
+    switch (lex_table.char_class[(uint8_t)data.at(index)]) {
+    case CharClass::NEWLINE_CHAR:
       handle_newline(tok);
       if (parentheses_count == 0) {
         state = LexerState::INDENTATION;
         return;
       }
       break;
-    case '0':
-    case '1':
-    case '2':
-    case '3':
-    case '4':
-    case '5':
-    case '6':
-    case '7':
-    case '8':
-    case '9':
+    case CharClass::DIGIT:
       handle_numeric(tok);
       return;
-    default: // It's some kind of keyword or identifier
-      if (isalpha(data.at(index))) {
-        found_word = true;
-      } else { // Or maybe something really wonky we don't recognize
-        tok.type = TokenType::UNKNOWN;
-        tok.view = data.substr(index++, 1);
-        return;
-      }
+    case CharClass::LETTER:
+      handle_word(tok);
+      return;
+    default: // Operators, and anything we don't recognize
+      handle_operator(tok);
+      return;
     }
   }
+}
 
-  uint64_t begin = index, i;
-  for (i = 0; index < data.size() && isalnum(data.at(index)); i++, index++)
-    ;
+void Lexer::handle_word(Token &tok) {
+  uint64_t begin = index;
+  index = scanner.alnum(data.begin, index);
+  uint64_t i = index - begin;
 
-  auto running_string = tok.view = String{&data.at(begin), i};
+  tok.view = String{&data.at(begin), i};
 
-  if (running_string == "def") {
-    tok.type = TokenType::DEF;
-  } else if (running_string == "None") {
-    tok.type = TokenType::NONE;
-  } else if (running_string == "return") {
-    tok.type = TokenType::RETURN;
-  } else if (running_string == "pass") {
-    tok.type = TokenType::PASS;
-  } else {
+  if (!lookup_keyword(tok.view.begin, i, tok.type)) {
     tok.type = TokenType::IDENT;
+    tok.identifier_idx = identifiers.intern(data.substr(begin, i));
+  }
 
-    String id_value = data.substr(begin, i);
-    uint32_t &id = id_map[id_value];
-    if (id == 0) {
-      id = identifiers.size();
-      identifiers.push_back(id_value);
+  if (index == data.size()) {
+    state = LexerState::END;
+  }
+}
+
+void Lexer::handle_operator(Token &tok) {
+  const char *begin = &data.at(index);
+  const char *end = begin + 1;
+  uint8_t accepted = LexTable::DEAD;
+
+  // Longest match: keep going while there's a transition, and remember the
+  // last accepting state. The NUL sentinel has no transitions.
+  uint8_t s = LexTable::START;
+  for (const char *p = begin;
+       (s = lex_table.next[s][lex_table.char_class[(uint8_t)*p]]) !=
+       LexTable::DEAD;
+       p++) {
+    if (lex_table.accept[s] != TokenType::UNKNOWN) {
+      accepted = s;
+      end = p + 1;
     }
+  }
 
-    tok.identifier_idx = id;
+  tok.type = lex_table.accept[accepted];
+  tok.view = String{begin, end};
+  index = end - data.begin;
+
+  int8_t nesting = lex_table.nesting[accepted];
+  if (nesting > 0 || parentheses_count > 0) {
+    parentheses_count += nesting;
   }
 
   if (index == data.size()) {
@@ -393,29 +502,31 @@ bool Lexer::handle_newline(Token &tok) {
 }
 
 void Lexer::handle_numeric(Token &tok) {
-  char *begin = const_cast<char *>(&data.at(index));
-  uint64_t len = 1;
-  for (index += 1; data.at(index) >= '0' && data.at(index) <= '9';
-       index++, len++)
-    ;
+  const char *begin = &data.at(index);
+  NumberLiteral literal;
+  const char *end = parse_number(begin, literal);
+  index = end - data.begin;
+  tok.view = String{begin, end};
 
-  bool found_dot = data.at(index) == '.';
-
-  if (found_dot) {
-    for (len += 1, index += 1; data.at(index) >= '0' && data.at(index) <= '9';
-         index++, len++)
-      ;
-  }
-  tok.view = String{begin, len};
-
-  char *end = begin + len;
-  if (found_dot) {
+  if (literal.error != nullptr) {
+    tok.type = TokenType::UNKNOWN;
+    errors.push_back(LexError{tok.view, literal.error});
+  } else if (literal.is_float) {
     tok.type = TokenType::FLOATING_POINT;
-    tok.floating_value = std::strtod(begin, &end);
+    tok.floating_value = literal.floating_value;
   } else {
     tok.type = TokenType::INTEGER;
-    tok.integer_value = std::strtol(begin, &end, 10);
+    tok.integer_value = literal.integer_value;
+  }
+}
+
+const char *Lexer::error_message(String location) {
+  for (auto it = errors.rbegin(); it != errors.rend(); ++it) {
+    if (it->location.begin == location.begin) {
+      return it->message;
+    }
   }
+  return nullptr;
 }
 
 std::ostream &operator<<(std::ostream &os, const Token &token) {
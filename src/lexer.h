@@ -1,12 +1,12 @@
 #pragma once
+#include "interner.h"
 #include "util.h"
 #include <cstdint>
 #include <ostream>
 #include <stdbool.h>
-#include <unordered_map>
 #include <vector>
 
-enum class TokenType {
+enum class TokenType : uint8_t {
   DEF,
   PASS,
   RETURN,
@@ -65,40 +65,65 @@ enum class TokenType {
 
 enum LexerState { NORMAL, INDENTATION, DEDENT, END };
 
+// What the lexer produces one at a time. Anything that keeps tokens around
+// should store them in a TokenStream instead.
 struct Token {
 
   TokenType type;
+  String view;
   union {
     double floating_value;
     uint64_t integer_value;
     uint32_t identifier_idx;
-    String view;
   };
 
   bool operator==(const Token &rhs) const;
   bool operator!=(const Token &rhs) const;
 };
 
+// `data` has to be followed by the zero padding SourceFile guarantees: the
+// inner loops stop on the NUL sentinel instead of checking the length, and
+// only token boundaries compare against data.size().
 struct Lexer {
+  struct LexError {
+    String location;
+    const char *message;
+  };
 
   String data;
-  std::unordered_map<String, uint32_t> id_map;
-  std::vector<String> identifiers;
+  StringInterner identifiers;
+  std::vector<LexError> errors;
   std::vector<uint32_t> indentation_stack;
   uint32_t index = 0;
   uint16_t indentation_level = 0;
   uint8_t parentheses_count = 0;
   uint8_t state = LexerState::INDENTATION;
 
-  explicit Lexer(const char *data);
+  // When set, line starts aren't resolved against indentation_stack: each
+  // one produces an INDENT token holding the line's leading whitespace, and
+  // its width is appended to deferred_levels. lex_parallel uses this to lex
+  // chunks without knowing the indentation they start at.
+  bool defer_indentation = false;
+  std::vector<uint32_t> deferred_levels;
+
+  Lexer(BucketArray *buckets, String data);
 
   Token next();
   void next(Token &tok);
+  // Lexes everything that is left, END token included. Meant for debugging
+  // dumps; the parser pulls tokens one at a time instead.
+  void lex_all(std::vector<Token> &tokens);
 
   void next_tok_normal(Token &tok);
   void next_tok_indent(Token &tok);
   void next_tok_dedent(Token &tok);
   void handle_numeric(Token &tok);
+  void handle_word(Token &tok);
+  void handle_operator(Token &tok);
+
+  // Why the UNKNOWN token at `location` was rejected, if the lexer knows more
+  // than that it didn't recognize it; nullptr otherwise.
+  const char *error_message(String location);
   bool handle_newline(Token &tok);
 };
 
@@ -1,7 +1,15 @@
+#include "ast_cache.h"
 #include "lexer.h"
+#include "parallel_lexer.h"
+#include "parallel_parser.h"
 #include "parser.h"
+#include "source.h"
 #include "util.h"
 #include <assert.h>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <errno.h>
 #include <iostream>
 
 const char *s = R"(
@@ -9,16 +17,110 @@ hi = bye(hello + 2, 3 *2, (32, (3, 2,21) , 1), 3*2, 3*2, 3*2, 3*2, 3*2, 3*2, 3*2
 print(hi)
 )";
 
-int main() {
+static double millis_since(std::chrono::steady_clock::time_point begin) {
+  auto elapsed = std::chrono::steady_clock::now() - begin;
+  return std::chrono::duration<double, std::milli>(elapsed).count();
+}
+
+// Prints what a phase added to the arena.
+static void print_arena_growth(const BucketArray::Stats &before,
+                               const BucketArray::Stats &after) {
+  std::cout << "arena +" << after.requested - before.requested
+            << " bytes requested, +" << after.reserved - before.reserved
+            << " reserved";
+}
+
+// usage: language [--time] [--quiet] [--mem-stats] [--threads N]
+//                 [--cache DIR] [--lazy] [--huge-pages] [file]
+// Without a file the built-in sample is used. --time reports how long
+// loading, lexing and parsing took; --quiet skips the token and AST dumps;
+// --mem-stats reports the identifier table and the memory each phase used;
+// --threads lexes the token dump and parses on N threads; --cache loads the
+// parsed program from DIR if it was stored there before, and stores it
+// otherwise; --lazy leaves def bodies unparsed until they're needed;
+// --huge-pages backs the arena's big buckets with transparent huge pages.
+int main(int argc, char **argv) {
+  bool report_time = false, quiet = false, lazy = false, mem_stats = false;
+  bool huge_pages = false;
+  uint32_t thread_count = 1;
+  const char *path = nullptr, *cache_directory = nullptr;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--time") == 0) {
+      report_time = true;
+    } else if (strcmp(argv[i], "--quiet") == 0) {
+      quiet = true;
+    } else if (strcmp(argv[i], "--lazy") == 0) {
+      lazy = true;
+    } else if (strcmp(argv[i], "--mem-stats") == 0) {
+      mem_stats = true;
+    } else if (strcmp(argv[i], "--huge-pages") == 0) {
+      huge_pages = true;
+    } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+      const char *count = argv[++i];
+      char *end;
+      errno = 0;
+      unsigned long value = strtoul(count, &end, 10);
+      if (end == count || *end != '\0' || errno != 0 || value < 1 ||
+          value > UINT32_MAX) {
+        std::cout << "usage: --threads takes a positive number, not '"
+                  << count << "'" << std::endl;
+        return 1;
+      }
+      thread_count = value;
+    } else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc) {
+      cache_directory = argv[++i];
+    } else {
+      path = argv[i];
+    }
+  }
+
+  auto begin = std::chrono::steady_clock::now();
+  SourceFile source;
+  if (path == nullptr) {
+    source.load_string(s);
+  } else if (!source.load(path)) {
+    std::cout << "couldn't load '" << path << "': " << strerror(errno)
+              << std::endl;
+    return 1;
+  }
+  double load_time = millis_since(begin);
+
   BucketArray buckets;
-  Parser p(&buckets, s);
+  buckets.huge_pages = huge_pages;
+
+  begin = std::chrono::steady_clock::now();
+  Lexer dump_lexer(&buckets, source.view());
+  std::vector<Token> tokens;
+  lex_parallel(dump_lexer, tokens, thread_count);
+  double lex_time = millis_since(begin);
+  BucketArray::Stats lexed = buckets.stats();
+
+  begin = std::chrono::steady_clock::now();
+  Parser p(&buckets, source.view());
+  p.defer_bodies = lazy;
   Program program;
+  // A program loaded from the cache still has its deferred bodies parsed
+  // through `p`.
+  p.program = &program;
+  AstCache cache(cache_directory);
+  bool cached = cache_directory != nullptr &&
+                cache.load(source.view(), lazy, program, p.lexer.identifiers);
+  bool a = cached || parse_parallel(p, program, thread_count);
+  double parse_time = millis_since(begin);
+  BucketArray::Stats parsed = buckets.stats();
+  if (cache_directory != nullptr && !cached && a) {
+    cache.store(source.view(), lazy, program, p.lexer.identifiers);
+  }
 
-  bool a = p.try_parse_program(program);
-  for (Token &tok : p.tokens) {
-    std::cout << "(" << tok << ") ";
+  if (!quiet) {
+    for (Token &tok : tokens) {
+      std::cout << "(" << tok << ") ";
+    }
+    std::cout << std::endl;
+  }
+  if (cache_directory != nullptr) {
+    std::cout << cache.stats << std::endl;
   }
-  std::cout << std::endl;
 
   if (!a) {
     std::cout << "error" << std::endl;
@@ -26,6 +128,35 @@ int main() {
               << "' had error: " << p.error.message << std::endl;
   }
 
-  std::cout << program << std::endl;
+  if (!quiet) {
+    std::cout << program << std::endl;
+  }
+
+  if (report_time) {
+    std::cout << "load: " << load_time << " ms, lex: " << lex_time
+              << " ms (" << tokens.size() << " tokens, "
+              << source.size / 1000.0 / lex_time << " MB/s), parse: "
+              << parse_time << " ms" << std::endl;
+  }
+
+  if (mem_stats) {
+    StringInterner::Stats lex_ids = dump_lexer.identifiers.stats();
+    StringInterner::Stats parse_ids = p.lexer.identifiers.stats();
+    std::cout << parse_ids << std::endl;
+    std::cout << "lex memory: " << tokens.capacity() * sizeof(Token)
+              << " token bytes, " << lex_ids.key_bytes + lex_ids.table_bytes
+              << " identifier bytes, ";
+    print_arena_growth(BucketArray::Stats{}, lexed);
+    std::cout << std::endl;
+    std::cout << "parse memory: " << program.bytes() << " node bytes, "
+              << parse_ids.key_bytes + parse_ids.table_bytes
+              << " identifier bytes, ";
+    print_arena_growth(lexed, parsed);
+    std::cout << std::endl;
+    std::cout << "arena: " << buckets.stats() << std::endl;
+  }
+
+  cache.free();
   buckets.free();
+  source.free();
 }
@@ -0,0 +1,186 @@
+#include "number.h"
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+static inline bool is_digit(char c) { return (unsigned char)(c - '0') < 10; }
+
+static inline int radix_digit(char c, uint32_t shift) {
+  if (shift == 1) {
+    return (unsigned char)(c - '0') < 2 ? c - '0' : -1;
+  }
+  if (is_digit(c)) {
+    return c - '0';
+  }
+  c |= 0x20;
+  return (unsigned char)(c - 'a') < 6 ? c - 'a' + 10 : -1;
+}
+
+// Loads 8 bytes so that the first character ends up in the lowest byte.
+static inline uint64_t load_eight(const char *p) {
+  uint64_t chunk;
+  memcpy(&chunk, p, 8);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  chunk = __builtin_bswap64(chunk);
+#endif
+  return chunk;
+}
+
+// SWAR check and conversion for 8 ASCII digits at once, see
+// https://lemire.me/blog/2022/01/21/swar-explained-parsing-eight-digits/
+static inline bool is_eight_digits(uint64_t chunk) {
+  return ((chunk & 0xf0f0f0f0f0f0f0f0) |
+          (((chunk + 0x0606060606060606) & 0xf0f0f0f0f0f0f0f0) >> 4)) ==
+         0x3333333333333333;
+}
+
+static inline uint32_t parse_eight_digits(uint64_t chunk) {
+  const uint64_t mask = 0x000000ff000000ff;
+  const uint64_t mul1 = 0x000f424000000064; // 100 + (1000000 << 32)
+  const uint64_t mul2 = 0x0000271000000001; // 1 + (10000 << 32)
+  chunk -= 0x3030303030303030;
+  chunk = (chunk * 10) + (chunk >> 8);
+  return (((chunk & mask) * mul1) + (((chunk >> 16) & mask) * mul2)) >> 32;
+}
+
+struct DigitRun {
+  uint64_t value;
+  uint32_t digits;
+  bool overflow;
+  bool bad_separator;
+};
+
+// Accumulates a run of decimal digits into `run`, skipping single
+// underscores between digits. `p` must point at a digit.
+static const char *scan_decimal(const char *p, DigitRun &run) {
+  for (;;) {
+    uint64_t chunk = load_eight(p);
+    if (is_eight_digits(chunk)) {
+      run.overflow |= __builtin_mul_overflow(run.value, 100000000, &run.value);
+      run.overflow |= __builtin_add_overflow(
+          run.value, parse_eight_digits(chunk), &run.value);
+      run.digits += 8;
+      p += 8;
+    } else if (is_digit(*p)) {
+      run.overflow |= __builtin_mul_overflow(run.value, 10, &run.value);
+      run.overflow |= __builtin_add_overflow(run.value, *p - '0', &run.value);
+      run.digits++;
+      p++;
+    } else if (*p == '_') {
+      p++;
+      if (!is_digit(*p)) {
+        run.bad_separator = true;
+        return p;
+      }
+    } else {
+      return p;
+    }
+  }
+}
+
+// Hex and binary digits after the prefix. Unlike decimal runs, a separator
+// may come right after the prefix (`0x_ff`).
+static const char *scan_radix(const char *p, uint32_t shift, DigitRun &run) {
+  for (;;) {
+    int digit = radix_digit(*p, shift);
+    if (digit >= 0) {
+      run.overflow |= (run.value >> (64 - shift)) != 0;
+      run.value = run.value << shift | digit;
+      run.digits++;
+      p++;
+    } else if (*p == '_') {
+      p++;
+      if (radix_digit(*p, shift) < 0) {
+        run.bad_separator = true;
+        return p;
+      }
+    } else {
+      return p;
+    }
+  }
+}
+
+static const double powers_of_ten[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+// Slow path for decimals whose digits don't fit the fast path. strtod rounds
+// correctly; it is only locale sensitive through the decimal point, and the
+// compiler never changes the locale away from "C".
+static double parse_float_slow(const char *begin, const char *end) {
+  std::string text;
+  text.reserve(end - begin);
+  for (const char *p = begin; p != end; p++) {
+    if (*p != '_') {
+      text.push_back(*p);
+    }
+  }
+  return std::strtod(text.c_str(), nullptr);
+}
+
+const char *parse_number(const char *begin, NumberLiteral &literal) {
+  DigitRun run = {0, 0, false, false};
+  literal.is_float = false;
+  literal.error = nullptr;
+
+  uint32_t shift = 0;
+  if (begin[0] == '0' && (begin[1] | 0x20) == 'x') {
+    shift = 4;
+  } else if (begin[0] == '0' && (begin[1] | 0x20) == 'b') {
+    shift = 1;
+  }
+
+  if (shift != 0) {
+    const char *end = scan_radix(begin + 2, shift, run);
+    literal.integer_value = run.value;
+    if (run.bad_separator) {
+      literal.error = "misplaced digit separator in numeric literal";
+    } else if (run.digits == 0) {
+      literal.error = "expected digits after the radix prefix";
+    } else if (run.overflow) {
+      literal.error = "integer literal doesn't fit in 64 bits";
+    }
+    return end;
+  }
+
+  const char *end = scan_decimal(begin, run);
+  if (run.bad_separator) {
+    literal.error = "misplaced digit separator in numeric literal";
+    return end;
+  }
+
+  if (*end != '.') {
+    literal.integer_value = run.value;
+    if (run.overflow) {
+      literal.error = "integer literal doesn't fit in 64 bits";
+    }
+    return end;
+  }
+
+  literal.is_float = true;
+  uint32_t integer_digits = run.digits;
+  end++;
+  if (is_digit(*end)) {
+    end = scan_decimal(end, run);
+    if (run.bad_separator) {
+      literal.error = "misplaced digit separator in numeric literal";
+      return end;
+    }
+  }
+
+  // Clinger's fast path: both the mantissa and the power of ten are exact
+  // doubles, so a single division rounds correctly.
+  uint32_t fraction_digits = run.digits - integer_digits;
+  if (!run.overflow && run.value <= (1ull << 53) && fraction_digits <= 22) {
+    literal.floating_value =
+        (double)run.value / powers_of_ten[fraction_digits];
+  } else {
+    literal.floating_value = parse_float_slow(begin, end);
+  }
+
+  if (std::isinf(literal.floating_value)) {
+    literal.error = "float literal out of range";
+  }
+  return end;
+}
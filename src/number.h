@@ -0,0 +1,21 @@
+#pragma once
+#include <cstdint>
+
+struct NumberLiteral {
+  bool is_float;
+  union {
+    uint64_t integer_value;
+    double floating_value;
+  };
+  const char *error; // nullptr if the literal is valid
+};
+
+// Parses the numeric literal that starts at `begin`, which must be a digit,
+// and returns a pointer one past its last character. Accepted forms are
+// decimal integers, decimals with a fractional part (`1.5`, `2.`), `0x`
+// hexadecimal and `0b` binary integers; any of them may separate digits
+// with single underscores (`1_000_000`, `0xff_ff`).
+//
+// Reads up to 8 bytes past the literal, so the buffer needs the padding that
+// SourceFile provides. Doesn't depend on the locale.
+const char *parse_number(const char *begin, NumberLiteral &literal);
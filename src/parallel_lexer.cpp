@@ -0,0 +1,223 @@
+#include "parallel_lexer.h"
+
+#define MIN_CHUNK_SIZE (256 * 1024)
+#define CHUNKS_PER_THREAD 4
+
+// What a deferred INDENT token turns into once the indentation stack is
+// known: `dedents` DEDENT tokens, followed by either an INDENT or an
+// UNKNOWN_DEDENT token if the matching flag is set.
+struct Indentation {
+  uint32_t dedents;
+  bool indent;
+  bool unknown_dedent;
+};
+
+// This is a pass-by-reference/pointer datastructure.
+struct LexChunk {
+  String data;
+  BucketArray buckets;
+  std::vector<Token> tokens;
+  std::vector<uint32_t> levels;
+  std::vector<Indentation> indentation;
+  std::vector<String> identifiers;
+  std::vector<uint32_t> identifier_map;
+  std::vector<Lexer::LexError> errors;
+  bool clean_end;
+  uint8_t end_parentheses;
+  uint64_t output_begin;
+};
+
+static bool starts_unindented_line(char c) {
+  return c != ' ' && c != '\t' && c != '\r' && c != '\n' && c != '\\' &&
+         c != '\0';
+}
+
+// Every chunk but the last ends right after a newline whose next line starts
+// with a token. Besides making the speculation below usually right, this
+// guarantees that every run the lexer scans stops at or before the chunk's
+// last byte, so a chunk lexes exactly like that stretch of the full input.
+void split_chunks(String data, uint64_t chunk_size,
+                  std::vector<String> &chunks) {
+  const char *begin = data.begin;
+  while ((uint64_t)(data.end - begin) > chunk_size + chunk_size / 2) {
+    const char *p = begin + chunk_size;
+    while ((p = (const char *)memchr(p, '\n', data.end - p)) != nullptr &&
+           (++p == data.end || !starts_unindented_line(*p)))
+      ;
+    if (p == nullptr || p == data.end) {
+      break;
+    }
+    chunks.push_back(String{begin, p});
+    begin = p;
+  }
+  chunks.push_back(String{begin, data.end});
+}
+
+static void lex_chunk(LexChunk &chunk, uint8_t state, uint8_t parentheses) {
+  // A chunk lexed again starts over, reusing a bucket of the last attempt.
+  chunk.buckets.rewind(BucketArray::Mark{});
+  chunk.tokens.clear();
+
+  Lexer lexer(&chunk.buckets, chunk.data);
+  lexer.defer_indentation = true;
+  lexer.state = state;
+  lexer.parentheses_count = parentheses;
+
+  Token tok;
+  while (true) {
+    uint8_t state_before = lexer.state;
+    lexer.next(tok);
+    if (tok.type == TokenType::END) {
+      // The input ran out while looking for the next line's indentation, so
+      // the next chunk really does start a logical line.
+      chunk.clean_end = state_before == LexerState::INDENTATION;
+      chunk.end_parentheses = lexer.parentheses_count;
+      break;
+    }
+    chunk.tokens.push_back(tok);
+  }
+
+  chunk.levels = std::move(lexer.deferred_levels);
+  chunk.identifiers = std::move(lexer.identifiers.strings);
+  chunk.errors = std::move(lexer.errors);
+}
+
+// Mirrors next_tok_indent and next_tok_dedent for one line start.
+static Indentation resolve_indentation(std::vector<uint32_t> &stack,
+                                       uint32_t level) {
+  Indentation result = {0, false, false};
+  if (level > stack.back()) {
+    result.indent = true;
+    stack.push_back(level);
+    return result;
+  }
+  while (level < stack.back()) {
+    stack.pop_back();
+    if (level > stack.back()) {
+      result.unknown_dedent = true;
+      stack.push_back(level);
+      return result;
+    }
+    result.dedents++;
+  }
+  return result;
+}
+
+static void write_chunk(const LexChunk &chunk, Token *out) {
+  const Indentation *indentation = chunk.indentation.data();
+  for (const Token &tok : chunk.tokens) {
+    switch (tok.type) {
+    case TokenType::INDENT: {
+      Token dedent;
+      dedent.type = TokenType::DEDENT;
+      dedent.view = String{tok.view.end, tok.view.end};
+      for (uint32_t i = 0; i < indentation->dedents; i++) {
+        *out++ = dedent;
+      }
+      if (indentation->indent) {
+        *out++ = tok;
+      } else if (indentation->unknown_dedent) {
+        dedent.type = TokenType::UNKNOWN_DEDENT;
+        *out++ = dedent;
+      }
+      indentation++;
+      break;
+    }
+    case TokenType::IDENT:
+      *out = tok;
+      out->identifier_idx = chunk.identifier_map[tok.identifier_idx];
+      out++;
+      break;
+    default:
+      *out++ = tok;
+    }
+  }
+}
+
+void lex_parallel(Lexer &lexer, std::vector<Token> &tokens,
+                  uint32_t thread_count) {
+  if (thread_count < 1) {
+    thread_count = 1;
+  }
+  uint64_t chunk_size = lexer.data.size() / (thread_count * CHUNKS_PER_THREAD);
+  if (chunk_size < MIN_CHUNK_SIZE) {
+    chunk_size = MIN_CHUNK_SIZE;
+  }
+
+  std::vector<String> chunk_data;
+  split_chunks(lexer.data, chunk_size, chunk_data);
+  if (thread_count <= 1 || chunk_data.size() == 1) {
+    lexer.lex_all(tokens);
+    return;
+  }
+
+  uint32_t chunk_count = chunk_data.size();
+  LexChunk *chunks = new LexChunk[chunk_count];
+  for (uint32_t i = 0; i < chunk_count; i++) {
+    chunks[i].data = chunk_data[i];
+    chunks[i].buckets.huge_pages = lexer.identifiers.buckets->huge_pages;
+  }
+
+  parallel_for(chunk_count, thread_count, [&](uint32_t i) {
+    lex_chunk(chunks[i], LexerState::INDENTATION, 0);
+  });
+
+  // Sequential part: proportional to the number of lines and of distinct
+  // identifiers per chunk, not to the number of tokens.
+  std::vector<uint32_t> stack = {0};
+  uint64_t output_size = tokens.size();
+  for (uint32_t i = 0; i < chunk_count; i++) {
+    LexChunk &chunk = chunks[i];
+    if (i > 0 && !chunks[i - 1].clean_end) {
+      lex_chunk(chunk, LexerState::NORMAL, chunks[i - 1].end_parentheses);
+    }
+
+    // Error locations point into the shared input, so they stay valid
+    // as they are.
+    lexer.errors.insert(lexer.errors.end(), chunk.errors.begin(),
+                        chunk.errors.end());
+
+    chunk.output_begin = output_size;
+    output_size += chunk.tokens.size() - chunk.levels.size();
+    chunk.indentation.reserve(chunk.levels.size());
+    for (uint32_t level : chunk.levels) {
+      Indentation indentation = resolve_indentation(stack, level);
+      output_size += indentation.dedents + indentation.indent +
+                     indentation.unknown_dedent;
+      chunk.indentation.push_back(indentation);
+    }
+
+    // Local ids are in order of first appearance within the chunk, so
+    // interning them in id order keeps global ids in order of first
+    // appearance across the whole input. The keys are in the chunk's arena,
+    // which the lexer's adopts below, so they don't need copying.
+    chunk.identifier_map.reserve(chunk.identifiers.size());
+    for (String identifier : chunk.identifiers) {
+      chunk.identifier_map.push_back(lexer.identifiers.intern(
+          identifier, hash_string(identifier), false));
+    }
+  }
+
+  tokens.resize(output_size + stack.size());
+  parallel_for(chunk_count, thread_count, [&](uint32_t i) {
+    write_chunk(chunks[i], &tokens[chunks[i].output_begin]);
+  });
+
+  Token tok;
+  tok.view = String{lexer.data.end, lexer.data.end};
+  tok.type = TokenType::DEDENT;
+  for (uint64_t i = output_size; i < tokens.size() - 1; i++) {
+    tokens[i] = tok;
+  }
+  tok.type = TokenType::END;
+  tokens.back() = tok;
+
+  lexer.index = lexer.data.size();
+  lexer.state = LexerState::END;
+  lexer.indentation_stack.resize(1);
+
+  for (uint32_t i = 0; i < chunk_count; i++) {
+    lexer.identifiers.buckets->adopt(&chunks[i].buckets);
+  }
+  delete[] chunks;
+}
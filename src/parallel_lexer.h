@@ -0,0 +1,26 @@
+#pragma once
+#include "lexer.h"
+#include <vector>
+
+// Splits `data` into chunks of about `chunk_size` bytes. Every chunk but the
+// last ends right after a newline whose next line starts with a token, so
+// chunks usually start at a top-level line.
+void split_chunks(String data, uint64_t chunk_size,
+                  std::vector<String> &chunks);
+
+// Lexes all of lexer.data on up to thread_count threads (a count of 0 means
+// 1) and appends the tokens, END included, to `tokens`. `lexer` has to be
+// freshly constructed; the result, identifier ids in lexer.identifiers and
+// errors in lexer.errors included, is identical to what
+// lexer.lex_all(tokens) would produce.
+//
+// The input is split after newlines that are followed by an unindented,
+// non-blank line, and each chunk is lexed speculatively as if it began a
+// logical line outside any parentheses, with indentation deferred. A
+// fix-up pass then re-lexes chunks whose predecessor actually ended inside
+// parentheses or a line continuation, resolves the deferred INDENT/DEDENT
+// tokens against one indentation stack, and maps chunk-local identifier ids
+// to global ones. Only that pass's bookkeeping is sequential; copying the
+// tokens into place runs on the threads again.
+void lex_parallel(Lexer &lexer, std::vector<Token> &tokens,
+                  uint32_t thread_count);
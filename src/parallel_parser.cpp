@@ -0,0 +1,154 @@
+#include "parallel_parser.h"
+#include "parallel_lexer.h"
+
+#define MIN_PARSE_CHUNK_SIZE (256 * 1024)
+#define PARSE_CHUNKS_PER_THREAD 4
+
+// This is a pass-by-reference/pointer datastructure.
+struct ParseChunk {
+  BucketArray buckets;
+  Program program;
+  uint32_t begin, end;
+  // Parser::statement_end after the chunk's last statement, and where the
+  // first token after it is.
+  uint32_t statement_end;
+  uint32_t next_statement;
+  bool parsed;
+  Parser::ParseError error;
+  std::vector<String> identifiers;
+  std::vector<uint32_t> identifier_map;
+  NodeCounts at;
+  uint32_t statement_at;
+};
+
+// Parses the statements that start before the chunk's end.
+static void parse_chunk(ParseChunk &chunk, String data, bool defer_bodies) {
+  // A chunk parsed again starts over, reusing a bucket of the last attempt.
+  chunk.buckets.rewind(BucketArray::Mark{});
+  chunk.program = Program();
+  chunk.program.exprs.reserve((chunk.end - chunk.begin) / 4);
+  chunk.program.expr_spans.reserve((chunk.end - chunk.begin) / 4);
+
+  Parser parser(&chunk.buckets, data);
+  parser.program = &chunk.program;
+  parser.defer_bodies = defer_bodies;
+  parser.restart(data, chunk.begin);
+  chunk.parsed = true;
+  while (parser.peek() != TokenType::END &&
+         parser.tokens.offsets[parser.cursor] < chunk.end) {
+    if (!parser.try_parse_statement()) {
+      chunk.parsed = false;
+      chunk.error = parser.error;
+      break;
+    }
+  }
+
+  chunk.statement_end = parser.statement_end;
+  chunk.next_statement = parser.tokens.offsets[parser.cursor];
+  chunk.identifiers = std::move(parser.lexer.identifiers.strings);
+}
+
+static void write_chunk(const ParseChunk &chunk, Program &program) {
+  const Program &from = chunk.program;
+  NodeRange range{NodeCounts{0, 0, 0, 0}, from.node_counts()};
+  NodeCounts delta =
+      program.copy_nodes(from, range, chunk.at, chunk.identifier_map.data());
+  for (uint32_t i = 0; i < from.statements.size(); i++) {
+    Stmt stmt = from.statements[i];
+    stmt.relocate(delta);
+    program.statements[chunk.statement_at + i] = stmt;
+    program.statement_spans[chunk.statement_at + i] = from.statement_spans[i];
+  }
+}
+
+bool parse_parallel(Parser &parser, Program &program, uint32_t thread_count) {
+  // Deferred bodies are parsed into `program` later, through this parser.
+  parser.program = &program;
+  if (thread_count < 1) {
+    thread_count = 1;
+  }
+  String data = parser.lexer.data;
+  uint64_t chunk_size = data.size() / (thread_count * PARSE_CHUNKS_PER_THREAD);
+  if (chunk_size < MIN_PARSE_CHUNK_SIZE) {
+    chunk_size = MIN_PARSE_CHUNK_SIZE;
+  }
+
+  std::vector<String> chunk_data;
+  split_chunks(data, chunk_size, chunk_data);
+  if (thread_count <= 1 || chunk_data.size() == 1) {
+    return parser.try_parse_program(program);
+  }
+
+  uint32_t chunk_count = chunk_data.size();
+  ParseChunk *chunks = new ParseChunk[chunk_count];
+  for (uint32_t i = 0; i < chunk_count; i++) {
+    chunks[i].begin = chunk_data[i].begin - data.begin;
+    chunks[i].end = chunk_data[i].end - data.begin;
+    chunks[i].buckets.huge_pages = parser.buckets->huge_pages;
+  }
+
+  parallel_for(chunk_count, thread_count, [&](uint32_t i) {
+    parse_chunk(chunks[i], data, parser.defer_bodies);
+  });
+
+  // Sequential part: proportional to the number of chunks and of distinct
+  // identifiers per chunk, unless a chunk has to be parsed again.
+  bool parsed = true;
+  NodeCounts count = {0, 0, 0, 0};
+  uint32_t statement_count = 0;
+  uint32_t next_statement = 0, statement_end = 0;
+  for (uint32_t i = 0; i < chunk_count && parsed; i++) {
+    ParseChunk &chunk = chunks[i];
+    // Unless the previous chunk stopped right in front of this one, this
+    // one started in the middle of a statement.
+    if (chunk.begin != next_statement) {
+      chunk.begin = statement_end;
+      parse_chunk(chunk, data, parser.defer_bodies);
+    }
+    if (!chunk.parsed) {
+      parser.error = chunk.error;
+      parsed = false;
+    }
+    next_statement = chunk.next_statement;
+    statement_end = chunk.statement_end;
+
+    NodeCounts size = chunk.program.node_counts();
+    chunk.at = count;
+    chunk.statement_at = statement_count;
+    count.exprs += size.exprs;
+    count.extra += size.extra;
+    count.functions += size.functions;
+    count.body_statements += size.body_statements;
+    statement_count += chunk.program.statements.size();
+
+    // Local ids are in order of first appearance within the chunk and the
+    // tokens its parser looked ahead at, so interning them in id order
+    // keeps global ids in order of first appearance across the input. The
+    // keys are adopted along with the chunk's arena below.
+    chunk.identifier_map.reserve(chunk.identifiers.size());
+    for (String identifier : chunk.identifiers) {
+      chunk.identifier_map.push_back(parser.lexer.identifiers.intern(
+          identifier, hash_string(identifier), false));
+    }
+  }
+
+  if (parsed) {
+    program.exprs.resize(count.exprs);
+    program.expr_spans.resize(count.exprs);
+    program.extra.resize(count.extra);
+    program.functions.resize(count.functions);
+    program.body_statements.resize(count.body_statements);
+    program.body_statement_spans.resize(count.body_statements);
+    program.statements.resize(statement_count);
+    program.statement_spans.resize(statement_count);
+    parallel_for(chunk_count, thread_count,
+                 [&](uint32_t i) { write_chunk(chunks[i], program); });
+    parser.statement_end = statement_end;
+  }
+
+  for (uint32_t i = 0; i < chunk_count; i++) {
+    parser.buckets->adopt(&chunks[i].buckets);
+  }
+  delete[] chunks;
+  return parsed;
+}
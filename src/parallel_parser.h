@@ -0,0 +1,17 @@
+#pragma once
+#include "parser.h"
+
+// Parses all of parser.lexer.data into `program` on up to thread_count
+// threads (a count of 0 means 1). `parser` has to be freshly constructed;
+// the result, identifier ids included, is identical to what
+// parser.try_parse_program(program) would produce, and so is the error if
+// there is one.
+//
+// The input is split like lex_parallel splits it, and each chunk is parsed
+// with its own Parser and arena as if it started a top-level statement,
+// until the next statement would start at or past the chunk's end. A chunk
+// that its predecessor didn't stop right in front of is parsed again from
+// the right place. The chunks' nodes are then copied into
+// `program` in source order, on the threads again, with indices relocated
+// and chunk-local identifier ids mapped to global ones.
+bool parse_parallel(Parser &parser, Program &program, uint32_t thread_count);
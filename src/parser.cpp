@@ -1,4 +1,5 @@
 #include "parser.h"
+#include <assert.h>
 
 // Propogate
 #define prop(expr)                                                             \
@@ -13,242 +14,498 @@
     return false;                                                              \
   }
 
-Parser::Parser(BucketArray *_buckets, const char *data)
-    : lexer(data), buckets(_buckets) {
-  Token tok;
-  do
-    tokens.push_back(tok = lexer.next());
-  while (tok.type != TokenType::END);
+Parser::Parser(BucketArray *_buckets, String data)
+    : buckets(_buckets), lexer(_buckets, data),
+      tokens(data, &lexer.identifiers) {}
+
+TokenType Parser::peek(uint32_t ahead) {
+  while (cursor + ahead >= tokens.size()) {
+    lex_batch();
+  }
+  return tokens.types[cursor + ahead];
 }
 
-const Token &Parser::peek() { return tokens.at(index); }
-const Token &Parser::pop() { return tokens.at(index++); }
+uint32_t Parser::pop() {
+  peek();
+  return cursor++;
+}
 
-bool Parser::try_parse_program(Program &program) {
-  Stmt stmt;
-  bool result = true;
-  while (peek().type != TokenType::END &&
-         (result = try_parse_statement(stmt))) {
-    program.statements.push_back(std::move(stmt));
+void Parser::lex_batch() {
+  tokens.discard(cursor);
+  cursor = 0;
+
+  Token tok;
+  uint32_t count = batch_size;
+  if (batch_size < PARSER_LEX_BATCH) {
+    batch_size *= 2;
   }
+  for (uint32_t i = 0; i < count; i++) {
+    lexer.next(tok);
+    tokens.push(tok);
+    if (tok.type == TokenType::END) {
+      return;
+    }
+  }
+}
 
-  return result;
+Span Parser::span(uint32_t tok) {
+  String view = tokens.view(tok);
+  return Span{(uint32_t)(view.begin - tokens.data.begin),
+              (uint32_t)(view.end - tokens.data.begin)};
 }
 
-bool Parser::try_parse_statement(Stmt &stmt) {
-  TokenType type = peek().type;
-  if (type == TokenType::PASS) { // Do nothing
-    pop();
-    return pop().type == TokenType::NEWLINE;
+uint32_t Parser::commit_scratch(uint32_t base) {
+  uint32_t first = program->extra.size();
+  program->extra.append(scratch.data() + base,
+                        scratch.data() + scratch.size());
+  scratch.resize(base);
+  return first;
+}
+
+bool Parser::try_parse_program(Program &_program) {
+  program = &_program;
+  scratch.clear();
+  // Dense code has about one node per four bytes; past that the arrays grow.
+  program->exprs.reserve(tokens.data.size() / 4);
+  program->expr_spans.reserve(tokens.data.size() / 4);
+  while (peek() != TokenType::END) {
+    prop(try_parse_statement());
+  }
+  return true;
+}
+
+bool Parser::try_parse_statement() {
+  uint32_t first_expr = program->exprs.size();
+  uint32_t tok;
+  TokenType type = peek();
+  if (block_depth == 0) {
+    statement_base = tokens.offsets[cursor];
+  }
+
+  if (type == TokenType::PASS) {
+    Span pass = span(pop());
+    tok = pop();
+    prop_err(tokens.types[tok] == TokenType::NEWLINE, tokens.view(tok),
+             "expected newline after pass");
+    end_statement(StmtType::Pass, 0, 0, pass, first_expr, span(tok).end);
+    return true;
+  }
+  if (type == TokenType::DEF) {
+    return try_parse_def(first_expr);
+  }
+
+  uint32_t expr;
+  if (type == TokenType::RETURN) {
+    Span stmt_span = span(pop());
+    if (peek() == TokenType::NEWLINE) {
+      expr = program->add_expr(ExprType::None, 0, 0, stmt_span);
+    } else {
+      prop(try_parse_expr(expr));
+      stmt_span.end = program->expr_spans[expr].end;
+    }
+    tok = pop();
+    prop_err(tokens.types[tok] == TokenType::NEWLINE, tokens.view(tok),
+             "expected newline after return");
+    end_statement(StmtType::Return, expr, 0, stmt_span, first_expr,
+                  span(tok).end);
+    return true;
   }
 
-  Expr expr;
   prop(try_parse_expr(expr));
+  Span stmt_span = program->expr_spans[expr];
 
-  if (peek().type == TokenType::NEWLINE) {
-    stmt.type = StmtType::Expr;
-    stmt.expr = expr;
-    pop();
+  if (peek() == TokenType::NEWLINE) {
+    end_statement(StmtType::Expr, expr, 0, stmt_span, first_expr,
+                  span(pop()).end);
     return true;
   }
 
-  Token tok = pop();
-  prop_err(tok.type == TokenType::EQUALS, tok.view,
+  tok = pop();
+  prop_err(tokens.types[tok] == TokenType::EQUALS, tokens.view(tok),
            "unrecognized token while trying to parse an expression");
 
-  stmt.type = StmtType::Assign;
-  stmt.assign_target = expr;
-  prop(try_parse_expr(expr));
-  stmt.assign_value = expr;
+  uint32_t value;
+  prop(try_parse_expr(value));
+  stmt_span.end = program->expr_spans[value].end;
   tok = pop();
-  prop_err(tok.type == TokenType::NEWLINE, tok.view,
+  prop_err(tokens.types[tok] == TokenType::NEWLINE, tokens.view(tok),
            "expected newline after assignment");
+  end_statement(StmtType::Assign, expr, value, stmt_span, first_expr,
+                span(tok).end);
   return true;
 }
 
-bool Parser::try_parse_expr(Expr &expr) { return try_parse_compare(expr); }
+// Width of a line's leading whitespace, counted like the lexer does.
+static uint32_t indentation_width(String whitespace) {
+  uint32_t width = 0;
+  for (const char *c = whitespace.begin; c != whitespace.end; c++) {
+    width += *c == '\t' ? 8 - width % 8 : 1;
+  }
+  return width;
+}
+
+bool Parser::try_parse_def(uint32_t first_expr) {
+  Span def_span = span(pop());
+  uint32_t tok = pop();
+  prop_err(tokens.types[tok] == TokenType::IDENT, tokens.view(tok),
+           "expected a function name after def");
+  uint32_t name = program->add_expr(ExprType::Ident, tokens.identifier(tok),
+                                    0, span(tok));
+
+  tok = pop();
+  prop_err(tokens.types[tok] == TokenType::LPAREN, tokens.view(tok),
+           "expected '(' after the function name");
+  uint32_t base = scratch.size();
+  while (peek() != TokenType::RPAREN) {
+    tok = pop();
+    prop_err(tokens.types[tok] == TokenType::IDENT, tokens.view(tok),
+             "expected a parameter name");
+    scratch.push_back(program->add_expr(ExprType::Ident,
+                                        tokens.identifier(tok), 0, span(tok)));
+    if (peek() != TokenType::COMMA) {
+      break;
+    }
+    pop();
+  }
+  tok = pop();
+  prop_err(tokens.types[tok] == TokenType::RPAREN, tokens.view(tok),
+           "expected ')' after the parameters");
+  uint32_t param_count = scratch.size() - base;
+  uint32_t params = commit_scratch(base);
+
+  tok = pop();
+  prop_err(tokens.types[tok] == TokenType::COLON, tokens.view(tok),
+           "expected ':' after the parameters");
+  tok = pop();
+  prop_err(tokens.types[tok] == TokenType::NEWLINE, tokens.view(tok),
+           "expected newline after ':'");
+  tok = pop();
+  prop_err(tokens.types[tok] == TokenType::INDENT, tokens.view(tok),
+           "expected an indented block");
+
+  // The body's expressions are relative to their own statements.
+  make_relative(first_expr, def_span.begin);
+  uint32_t function = program->functions.size();
+  program->functions.push_back(Function{
+      name, params, param_count, 0, 0,
+      Span{span(tok).begin - statement_base, 0}, block_indentation, false});
+  uint32_t end, dedent;
+  if (defer_bodies) {
+    prop(skip_block(end, dedent));
+  } else {
+    prop(try_parse_block(function, indentation_width(tokens.view(tok)), end,
+                         dedent));
+  }
+  program->functions[function].body.end = end - statement_base;
+  end_statement(StmtType::Def, function, 0, Span{def_span.begin, end},
+                program->exprs.size(), dedent);
+  return true;
+}
+
+// Parses statements up to the DEDENT that closes the block, and sets the
+// function's body to them. `end` is where the last one ends, `dedent` where
+// the DEDENT is.
+bool Parser::try_parse_block(uint32_t function, uint32_t indentation,
+                             uint32_t &end, uint32_t &dedent) {
+  uint32_t outer_indentation = block_indentation;
+  uint32_t base = statement_scratch.size();
+  block_indentation = indentation;
+  block_depth++;
+  while (peek() != TokenType::DEDENT) {
+    prop_err(peek() != TokenType::UNKNOWN_DEDENT, tokens.view(cursor),
+             "unindent doesn't match any outer indentation level");
+    prop(try_parse_statement());
+  }
+  block_depth--;
+  block_indentation = outer_indentation;
+
+  end = statement_base + statement_span_scratch.back().end;
+  dedent = span(pop()).begin;
+  Function &f = program->functions[function];
+  f.body_begin = program->body_statements.size();
+  f.body_count = statement_scratch.size() - base;
+  f.parsed = true;
+  program->body_statements.append(statement_scratch.data() + base,
+                                  statement_scratch.data() +
+                                      statement_scratch.size());
+  program->body_statement_spans.append(statement_span_scratch.data() + base,
+                                       statement_span_scratch.data() +
+                                           statement_span_scratch.size());
+  statement_scratch.resize(base);
+  statement_span_scratch.resize(base);
+  return true;
+}
 
-bool Parser::try_parse_compare(Expr &expr) {
-  prop(try_parse_add(expr));
+// Lexes through a block without building anything, checking that
+// indentation and brackets match up. The open brackets are kept on
+// `brackets`, which is back to its old size whichever way this returns.
+bool Parser::skip_block(uint32_t &end, uint32_t &dedent) {
+  uint32_t base = brackets.size();
+  bool skipped = skip_tokens(base, end, dedent);
+  brackets.resize(base);
+  return skipped;
+}
 
+bool Parser::skip_tokens(uint32_t base, uint32_t &end, uint32_t &dedent) {
+  uint32_t depth = 1;
   while (true) {
-    const TokenType type = peek().type;
-    ExprType expr_type;
+    uint32_t tok = pop();
+    TokenType type = tokens.types[tok];
     switch (type) {
-    case TokenType::EQUALS_EQUALS:
-      expr_type = ExprType::Eq;
-      break;
-    case TokenType::NOT_EQUAL:
-      expr_type = ExprType::Neq;
+    case TokenType::INDENT:
+      depth++;
       break;
-    case TokenType::LESS_EQ:
-      expr_type = ExprType::Leq;
+    case TokenType::DEDENT:
+      if (--depth == 0) {
+        prop_err(brackets.size() == base, tokens.view(tok),
+                 "unclosed bracket in function body");
+        dedent = span(tok).begin;
+        return true;
+      }
       break;
-    case TokenType::GREATER_EQ:
-      expr_type = ExprType::Geq;
+    case TokenType::UNKNOWN_DEDENT:
+      prop_err(false, tokens.view(tok),
+               "unindent doesn't match any outer indentation level");
+      return false;
+    case TokenType::NEWLINE:
       break;
-    case TokenType::GREATER_THAN:
-      expr_type = ExprType::Gt;
+    case TokenType::LPAREN:
+    case TokenType::LBRACKET:
+      brackets.push_back(type);
+      end = span(tok).end;
       break;
-    case TokenType::LESS_THAN:
-      expr_type = ExprType::Lt;
+    case TokenType::RPAREN:
+    case TokenType::RBRACKET: {
+      TokenType open = type == TokenType::RPAREN ? TokenType::LPAREN
+                                                 : TokenType::LBRACKET;
+      prop_err(brackets.size() > base && brackets.back() == open,
+               tokens.view(tok), "unmatched closing bracket");
+      brackets.pop_back();
+      end = span(tok).end;
       break;
+    }
     default:
-      return true;
+      end = span(tok).end;
     }
+  }
+}
 
-    pop();
+bool Parser::parse_body(uint32_t function, uint32_t base) {
+  const Function &f = program->functions[function];
+  if (f.parsed) {
+    return true;
+  }
+  restart(lexer.data, base + f.body.begin, f.indentation);
+  statement_base = base;
+  uint32_t tok = pop();
+  prop_err(tokens.types[tok] == TokenType::INDENT, tokens.view(tok),
+           "expected an indented block");
+  uint32_t end, dedent;
+  return try_parse_block(function, indentation_width(tokens.view(tok)), end,
+                         dedent);
+}
 
-    Expr *left = buckets->add<Expr>();
-    Expr *right = buckets->add<Expr>();
-    *left = expr;
+void Parser::end_statement(StmtType type, uint32_t a, uint32_t b,
+                           Span stmt_span, uint32_t first_expr,
+                           uint32_t end) {
+  make_relative(first_expr, stmt_span.begin);
+  if (block_depth == 0) {
+    program->add_statement(type, a, b, stmt_span);
+  } else {
+    statement_scratch.push_back(Stmt{type, a, b});
+    statement_span_scratch.push_back(Span{stmt_span.begin - statement_base,
+                                          stmt_span.end - statement_base});
+  }
+  statement_end = end;
+}
 
-    prop(try_parse_add(*right));
-    expr = Expr(expr_type, left, right);
+void Parser::make_relative(uint32_t first_expr, uint32_t begin) {
+  for (uint32_t i = first_expr; i < program->exprs.size(); i++) {
+    program->expr_spans[i].begin -= begin;
+    program->expr_spans[i].end -= begin;
   }
 }
 
-bool Parser::try_parse_add(Expr &expr) {
-  prop(try_parse_mul(expr));
+void Parser::restart(String data, uint32_t offset, uint32_t indentation) {
+  lexer.data = data;
+  lexer.index = offset;
+  lexer.state = LexerState::INDENTATION;
+  lexer.parentheses_count = 0;
+  lexer.indentation_stack.resize(1);
+  if (indentation > 0) {
+    lexer.indentation_stack.push_back(indentation);
+  }
+  lexer.errors.clear();
+  tokens.data = data;
+  tokens.discard(tokens.size());
+  cursor = 0;
+  batch_size = PARSER_FIRST_LEX_BATCH;
+  scratch.clear();
+  statement_scratch.clear();
+  statement_span_scratch.clear();
+  block_depth = 0;
+  block_indentation = indentation;
+  statement_end = offset;
+}
 
-  while (true) {
-    const TokenType type = peek().type;
-    ExprType expr_type;
-    if (type == TokenType::PLUS) {
-      expr_type = ExprType::Add;
-    } else if (type == TokenType::MINUS) {
-      expr_type = ExprType::Sub;
-    } else {
-      return true;
-    }
+// Binding powers of the tokens that can continue an expression, by
+// TokenType; 0 means the token ends it. An operator whose right binding power
+// is below its left one is right-associative. Calls and attribute access are
+// postfix, and bind tighter than everything else.
+struct InfixOp {
+  uint8_t left_binding = 0;
+  uint8_t right_binding = 0;
+  ExprType type = ExprType::None;
+};
 
-    pop();
+#define PREFIX_BINDING 70
 
-    Expr *left = buckets->add<Expr>();
-    Expr *right = buckets->add<Expr>();
-    *left = expr;
+struct InfixTable {
+  InfixOp ops[(uint32_t)TokenType::BOOL_TYPE + 1];
 
-    prop(try_parse_mul(*right));
-    expr = Expr(expr_type, left, right);
+  constexpr void set(TokenType token, uint8_t left, uint8_t right,
+                     ExprType type) {
+    ops[(uint32_t)token] = InfixOp{left, right, type};
   }
-  return true;
-}
 
-bool Parser::try_parse_mul(Expr &expr) {
-  prop(try_parse_unary_prefix(expr));
+  constexpr InfixTable() {
+    set(TokenType::EQUALS_EQUALS, 10, 11, ExprType::Eq);
+    set(TokenType::NOT_EQUAL, 10, 11, ExprType::Neq);
+    set(TokenType::LESS_EQ, 10, 11, ExprType::Leq);
+    set(TokenType::GREATER_EQ, 10, 11, ExprType::Geq);
+    set(TokenType::GREATER_THAN, 10, 11, ExprType::Gt);
+    set(TokenType::LESS_THAN, 10, 11, ExprType::Lt);
+    set(TokenType::PLUS, 30, 31, ExprType::Add);
+    set(TokenType::MINUS, 30, 31, ExprType::Sub);
+    set(TokenType::STAR, 50, 51, ExprType::Mul);
+    set(TokenType::DIV, 50, 51, ExprType::Div);
+    set(TokenType::DIV_DIV, 50, 51, ExprType::FloorDiv);
+    set(TokenType::PERCENT, 50, 51, ExprType::Mod);
+    // Above unary minus on the left, so -a ** b is -(a ** b), and below it
+    // on the right, so a ** -b works.
+    set(TokenType::STAR_STAR, 80, 69, ExprType::Pow);
+    set(TokenType::LPAREN, 90, 0, ExprType::Call);
+    set(TokenType::DOT, 90, 0, ExprType::Attr);
+  }
+};
+
+static constexpr InfixTable infix_table;
+
+bool Parser::try_parse_expr(uint32_t &expr, uint8_t min_binding) {
+  if (peek() == TokenType::MINUS) {
+    uint32_t begin = span(pop()).begin;
+    uint32_t operand;
+    prop(try_parse_expr(operand, PREFIX_BINDING));
+    expr = program->add_expr(ExprType::Neg, operand, 0,
+                             Span{begin, program->expr_spans[operand].end});
+  } else {
+    prop(try_parse_atom_expr(expr));
+  }
 
   while (true) {
-    TokenType type = peek().type;
-    ExprType expr_type;
-
-    if (type == TokenType::STAR) {
-      expr_type = ExprType::Mul;
-    } else if (type == TokenType::DIV) {
-      expr_type = ExprType::Div;
-    } else if (type == TokenType::PERCENT) {
-      expr_type = ExprType::Mod;
-    } else {
+    const InfixOp &op = infix_table.ops[(uint32_t)peek()];
+    if (op.left_binding <= min_binding) {
       return true;
     }
 
-    pop();
-
-    Expr *left = buckets->add<Expr>();
-    Expr *right = buckets->add<Expr>();
-    *left = expr;
+    if (op.type == ExprType::Call) {
+      prop(try_parse_call(expr));
+      continue;
+    }
 
-    prop(try_parse_unary_prefix(*right));
-    expr = Expr(expr_type, left, right);
+    pop();
+    uint32_t right;
+    if (op.type == ExprType::Attr) {
+      uint32_t tok = pop();
+      prop_err(tokens.types[tok] == TokenType::IDENT, tokens.view(tok),
+               "expected a name after '.'");
+      right = program->add_expr(ExprType::Ident, tokens.identifier(tok), 0,
+                                span(tok));
+    } else {
+      prop(try_parse_expr(right, op.right_binding));
+    }
+    expr = program->add_expr(op.type, expr, right,
+                             Span{program->expr_spans[expr].begin,
+                                  program->expr_spans[right].end});
   }
 }
 
-bool Parser::try_parse_unary_prefix(Expr &expr) {
-  return try_parse_unary_postfix(expr);
-}
-
-bool Parser::try_parse_unary_postfix(Expr &expr) {
-  prop(try_parse_atom_expr(expr)); // brackets and function calls
+bool Parser::try_parse_call(uint32_t &expr) {
+  uint32_t args;
+  prop(try_parse_atom_expr(args));
 
-  if (peek().type != TokenType::LPAREN) {
-    return true;
-  }
-
-  Expr *callee = buckets->add<Expr>();
-  *callee = expr;
-  Expr tup;
-  prop(try_parse_atom_expr(tup));
-
-  expr.type = ExprType::Call;
-  expr.callee = callee;
-  if (tup.type == ExprType::Tup) {
-    expr.call_tup_begin = tup.tup_begin;
-    expr.call_tup_end = tup.tup_end;
-  } else {
-    expr.call_tup_begin = buckets->add<Expr>();
-    *expr.call_tup_begin = tup;
-    expr.call_tup_end = expr.call_tup_begin + 1;
+  Span args_span = program->expr_spans[args];
+  if (program->exprs[args].type != ExprType::Tup) {
+    program->extra.push_back(args);
+    args = program->add_expr(ExprType::Tup, program->extra.size() - 1, 1,
+                             args_span);
   }
+  expr = program->add_expr(
+      ExprType::Call, expr, args,
+      Span{program->expr_spans[expr].begin, args_span.end});
   return true;
 }
 
-bool Parser::try_parse_atom_expr(Expr &expr) {
-  Token tok = pop();
+bool Parser::try_parse_atom_expr(uint32_t &expr) {
+  uint32_t tok = pop();
 
-  switch (tok.type) {
+  switch (tokens.types[tok]) {
   case TokenType::IDENT:
-    expr.type = ExprType::Ident;
-    expr.ident = tok.identifier_idx;
+    expr = program->add_expr(ExprType::Ident, tokens.identifier(tok), 0,
+                             span(tok));
     break;
   case TokenType::INTEGER:
-    expr.type = ExprType::Int;
-    expr.int_value = tok.integer_value;
+    expr = program->add_value(ExprType::Int, tokens.integer(tok), span(tok));
     break;
   case TokenType::FLOATING_POINT:
-    expr.type = ExprType::Float;
-    expr.float_value = tok.floating_value;
+    // Same payload bits as an integer.
+    expr = program->add_value(ExprType::Float, tokens.integer(tok), span(tok));
     break;
   case TokenType::NONE:
-    expr = ExprType::None;
+    expr = program->add_expr(ExprType::None, 0, 0, span(tok));
     break;
   case TokenType::LPAREN: {
-    if (peek().type == TokenType::RPAREN) {
-      pop();
-      expr.type = ExprType::Tup;
-      expr.tup_begin = expr.tup_end = nullptr;
+    uint32_t begin = span(tok).begin;
+    if (peek() == TokenType::RPAREN) {
+      expr = program->add_expr(ExprType::Tup, program->extra.size(), 0,
+                               Span{begin, span(pop()).end});
       break;
     }
 
     prop(try_parse_expr(expr));
-    if (peek().type == TokenType::RPAREN) {
-      pop();
+    if (peek() == TokenType::RPAREN) {
+      program->expr_spans[expr] = Span{begin, span(pop()).end};
       break;
     }
 
-    Token tok;
-    Expr tuple_expr;
-    Pool pool(buckets, 128);
-    *pool.add_extend<Expr>(buckets) = expr;
-
-    while ((tok = pop()).type == TokenType::COMMA) {
-      prop(try_parse_expr(tuple_expr));
-      *pool.add_extend<Expr>(buckets) = tuple_expr;
+    uint32_t base = scratch.size();
+    scratch.push_back(expr);
+    while (peek() == TokenType::COMMA) {
+      pop();
+      prop(try_parse_expr(expr));
+      scratch.push_back(expr);
     }
 
-    prop_err(tok.type == TokenType::RPAREN, tok.view,
+    tok = pop();
+    prop_err(tokens.types[tok] == TokenType::RPAREN, tokens.view(tok),
              "expected a closing paren");
-    auto block = pool.push_to_buckets(buckets);
-    expr.type = ExprType::Tup;
-    expr.tup_begin = (Expr *)block.begin;
-    expr.tup_end = (Expr *)block.progress;
+    uint32_t count = scratch.size() - base;
+    expr = program->add_expr(ExprType::Tup, commit_scratch(base), count,
+                             Span{begin, span(tok).end});
     break;
   }
-  default: // @TODO dictionary/list literals, slice literals, accessors
-    prop_err(false, tok.view,
+  case TokenType::UNKNOWN:
+    if (const char *message = lexer.error_message(tokens.view(tok))) {
+      prop_err(false, tokens.view(tok), message);
+    }
+    prop_err(false, tokens.view(tok),
+             "unrecognized token while trying to parse expression");
+    return false;
+  default: // @TODO dictionary/list literals, slice literals
+    prop_err(false, tokens.view(tok),
              "unrecognized token while trying to parse expression");
     return false;
   }
 
-  // do dot accessor stuff
-
   return true;
-}
\ No newline at end of file
+}
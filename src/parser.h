@@ -1,9 +1,13 @@
 #pragma once
 #include "lexer.h"
 #include "syntax_tree.h"
+#include "token_stream.h"
 #include "util.h"
 #include <vector>
 
+#define PARSER_LEX_BATCH 256
+#define PARSER_FIRST_LEX_BATCH 16
+
 struct Parser {
   struct ParseError {
     String location;
@@ -13,24 +17,82 @@ struct Parser {
   BucketArray *buckets;
   Lexer lexer;
   ParseError error;
-  std::vector<Token> tokens;
-  int index = 0;
 
-  Parser(BucketArray *buckets, const char *view);
+  // Tokens are lexed in batches as parsing reaches them, and consumed ones
+  // are dropped before the next batch, so memory doesn't depend on the
+  // length of the input. Batches start small after a restart, so parsing a
+  // short body doesn't lex far past it, and double up to PARSER_LEX_BATCH.
+  // A token index returned by pop is valid until the next peek or pop.
+  TokenStream tokens;
+  uint32_t cursor = 0;
+  uint32_t batch_size = PARSER_FIRST_LEX_BATCH;
+
+  Parser(BucketArray *buckets, String data);
+
+  TokenType peek(uint32_t ahead = 0);
+  uint32_t pop();
+  void lex_batch();
+
+  // Where the token's text is in the source.
+  Span span(uint32_t tok);
+
+  // Nodes are added to `program`, which try_parse_program sets.
+  Program *program = nullptr;
+
+  // Lists of children are gathered here while they're parsed, since nested
+  // lists interleave, then copied into program->extra in one go. A
+  // production remembers scratch.size() before pushing and commits from
+  // there; the stack is shared by all of them, so after warming up no list
+  // allocates.
+  std::vector<uint32_t> scratch;
+  uint32_t commit_scratch(uint32_t base);
+
+  // Statements of the def bodies being parsed, gathered like `scratch` and
+  // committed to program->body_statements when their block ends.
+  std::vector<Stmt> statement_scratch;
+  std::vector<Span> statement_span_scratch;
+  // Brackets open in a def body that skip_block is passing over.
+  std::vector<TokenType> brackets;
+  uint32_t block_depth = 0;
+  uint32_t block_indentation = 0;
+  // Where the top-level statement being parsed starts; spans inside it are
+  // relative to this.
+  uint32_t statement_base = 0;
+
+  // Where the line after the last statement parsed starts: just past its
+  // NEWLINE, or for a def, at the first token after its body.
+  uint32_t statement_end = 0;
 
-  const Token &peek();
-  const Token &pop();
+  // Only check def bodies' indentation and brackets while parsing, and
+  // leave them to parse_body.
+  bool defer_bodies = false;
 
   bool try_parse_program(Program &program);
-  bool try_parse_statement(Stmt &statement);
+  bool try_parse_statement();
+  bool try_parse_def(uint32_t first_expr);
+  bool try_parse_block(uint32_t function, uint32_t indentation,
+                       uint32_t &end, uint32_t &dedent);
+  bool skip_block(uint32_t &end, uint32_t &dedent);
+  bool skip_tokens(uint32_t base, uint32_t &end, uint32_t &dedent);
+  void end_statement(StmtType type, uint32_t a, uint32_t b, Span span,
+                     uint32_t first_expr, uint32_t end);
+  // Makes the spans of the expressions from `first_expr` on relative to
+  // `begin`.
+  void make_relative(uint32_t first_expr, uint32_t begin);
 
-  bool try_parse_compare(Expr &expr);
-  bool try_parse_add(Expr &expr);
-  bool try_parse_mul(Expr &expr);
+  // Parses the body of a def that was deferred. `base` is where the
+  // top-level statement the def is in starts. This moves the lexer, so it
+  // can't be called in the middle of another parse.
+  bool parse_body(uint32_t function, uint32_t base);
 
-  bool try_parse_unary_prefix(Expr &expr);
-  bool try_parse_unary_postfix(Expr &expr);
+  // Continues lexing `data` from `offset`, which has to be the start of a
+  // line outside of brackets, dropping any tokens already lexed.
+  // `indentation` is the width of the innermost enclosing block's
+  // indentation there, 0 at the top level.
+  void restart(String data, uint32_t offset, uint32_t indentation = 0);
 
-  bool try_parse_expr(Expr &expr);
-  bool try_parse_atom_expr(Expr &expr);
+  // Parses operators binding tighter than `min_binding`; see InfixTable.
+  bool try_parse_expr(uint32_t &expr, uint8_t min_binding = 0);
+  bool try_parse_call(uint32_t &expr);
+  bool try_parse_atom_expr(uint32_t &expr);
 };
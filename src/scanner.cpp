@@ -0,0 +1,157 @@
+#include "scanner.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SCANNER_X86 1
+#include <immintrin.h>
+#endif
+
+static inline bool is_blank(char c) { return c == ' ' || c == '\t'; }
+static inline bool is_digit(char c) { return (unsigned char)(c - '0') < 10; }
+static inline bool is_alnum(char c) {
+  return is_digit(c) || (unsigned char)((c | 0x20) - 'a') < 26;
+}
+
+static uint64_t scalar_blanks(const char *data, uint64_t index) {
+  for (; is_blank(data[index]); index++)
+    ;
+  return index;
+}
+
+static uint64_t scalar_alnum(const char *data, uint64_t index) {
+  for (; is_alnum(data[index]); index++)
+    ;
+  return index;
+}
+
+static uint64_t scalar_digits(const char *data, uint64_t index) {
+  for (; is_digit(data[index]); index++)
+    ;
+  return index;
+}
+
+#ifdef SCANNER_X86
+
+// The vector loops build a mask of the bytes that are still inside the run,
+// and stop at the first zero bit. Everything compares as signed bytes, so
+// bytes >= 0x80 are negative and never fall inside a range.
+
+__attribute__((target("sse2"))) static inline __m128i
+sse2_in_range(__m128i x, char lo, char hi) {
+  return _mm_and_si128(_mm_cmpgt_epi8(x, _mm_set1_epi8(lo - 1)),
+                       _mm_cmplt_epi8(x, _mm_set1_epi8(hi + 1)));
+}
+
+__attribute__((target("sse2"))) static uint64_t
+sse2_blanks(const char *data, uint64_t index) {
+  for (;; index += 16) {
+    __m128i x = _mm_loadu_si128((const __m128i *)(data + index));
+    __m128i m = _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8(' ')),
+                             _mm_cmpeq_epi8(x, _mm_set1_epi8('\t')));
+    uint32_t stop = ~_mm_movemask_epi8(m) & 0xffff;
+    if (stop) {
+      return index + __builtin_ctz(stop);
+    }
+  }
+}
+
+__attribute__((target("sse2"))) static uint64_t
+sse2_alnum(const char *data, uint64_t index) {
+  for (;; index += 16) {
+    __m128i x = _mm_loadu_si128((const __m128i *)(data + index));
+    __m128i lower = _mm_or_si128(x, _mm_set1_epi8(0x20));
+    __m128i m = _mm_or_si128(sse2_in_range(x, '0', '9'),
+                             sse2_in_range(lower, 'a', 'z'));
+    uint32_t stop = ~_mm_movemask_epi8(m) & 0xffff;
+    if (stop) {
+      return index + __builtin_ctz(stop);
+    }
+  }
+}
+
+__attribute__((target("sse2"))) static uint64_t
+sse2_digits(const char *data, uint64_t index) {
+  for (;; index += 16) {
+    __m128i x = _mm_loadu_si128((const __m128i *)(data + index));
+    uint32_t stop = ~_mm_movemask_epi8(sse2_in_range(x, '0', '9')) & 0xffff;
+    if (stop) {
+      return index + __builtin_ctz(stop);
+    }
+  }
+}
+
+__attribute__((target("avx2"))) static inline __m256i
+avx2_in_range(__m256i x, char lo, char hi) {
+  return _mm256_and_si256(_mm256_cmpgt_epi8(x, _mm256_set1_epi8(lo - 1)),
+                          _mm256_cmpgt_epi8(_mm256_set1_epi8(hi + 1), x));
+}
+
+__attribute__((target("avx2"))) static uint64_t
+avx2_blanks(const char *data, uint64_t index) {
+  for (;; index += 32) {
+    __m256i x = _mm256_loadu_si256((const __m256i *)(data + index));
+    __m256i m = _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8(' ')),
+                                _mm256_cmpeq_epi8(x, _mm256_set1_epi8('\t')));
+    uint32_t stop = ~(uint32_t)_mm256_movemask_epi8(m);
+    if (stop) {
+      return index + __builtin_ctz(stop);
+    }
+  }
+}
+
+__attribute__((target("avx2"))) static uint64_t
+avx2_alnum(const char *data, uint64_t index) {
+  for (;; index += 32) {
+    __m256i x = _mm256_loadu_si256((const __m256i *)(data + index));
+    __m256i lower = _mm256_or_si256(x, _mm256_set1_epi8(0x20));
+    __m256i m = _mm256_or_si256(avx2_in_range(x, '0', '9'),
+                                avx2_in_range(lower, 'a', 'z'));
+    uint32_t stop = ~(uint32_t)_mm256_movemask_epi8(m);
+    if (stop) {
+      return index + __builtin_ctz(stop);
+    }
+  }
+}
+
+__attribute__((target("avx2"))) static uint64_t
+avx2_digits(const char *data, uint64_t index) {
+  for (;; index += 32) {
+    __m256i x = _mm256_loadu_si256((const __m256i *)(data + index));
+    uint32_t stop = ~(uint32_t)_mm256_movemask_epi8(avx2_in_range(x, '0', '9'));
+    if (stop) {
+      return index + __builtin_ctz(stop);
+    }
+  }
+}
+
+#endif
+
+ScanLevel best_scan_level() {
+#ifdef SCANNER_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return ScanLevel::AVX2;
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    return ScanLevel::SSE2;
+  }
+#endif
+  return ScanLevel::Scalar;
+}
+
+static Scanner make_scanner(ScanLevel level) {
+  switch (level) {
+#ifdef SCANNER_X86
+  case ScanLevel::AVX2:
+    return Scanner{level, avx2_blanks, avx2_alnum, avx2_digits};
+  case ScanLevel::SSE2:
+    return Scanner{level, sse2_blanks, sse2_alnum, sse2_digits};
+#endif
+  default:
+    return Scanner{ScanLevel::Scalar, scalar_blanks, scalar_alnum,
+                   scalar_digits};
+  }
+}
+
+Scanner scanner = make_scanner(best_scan_level());
+
+void select_scanner(ScanLevel level) { scanner = make_scanner(level); }
@@ -0,0 +1,28 @@
+#pragma once
+#include <cstdint>
+
+// Character-run scanners used by the lexer's hot loops. Each one returns the
+// index of the first byte at or after `index` that is not part of the run.
+// There is no end bound: the buffer has to be padded the way SourceFile pads
+// it, so the NUL sentinel ends every run and vector loads past it stay inside
+// the allocation.
+//
+// The implementation is picked once at startup based on what the CPU
+// supports; select_scanner can override that (e.g. for benchmarking).
+
+enum class ScanLevel { Scalar, SSE2, AVX2 };
+
+struct Scanner {
+  ScanLevel level;
+  // Spaces and tabs
+  uint64_t (*blanks)(const char *data, uint64_t index);
+  // [0-9A-Za-z], same as isalnum in the C locale
+  uint64_t (*alnum)(const char *data, uint64_t index);
+  // [0-9]
+  uint64_t (*digits)(const char *data, uint64_t index);
+};
+
+extern Scanner scanner;
+
+ScanLevel best_scan_level();
+void select_scanner(ScanLevel level);
@@ -0,0 +1,72 @@
+#include "source.h"
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static inline uint64_t round_up(uint64_t value, uint64_t multiple) {
+  return (value + multiple - 1) / multiple * multiple;
+}
+
+bool SourceFile::load(const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return false;
+  }
+
+  uint64_t file_size = st.st_size;
+  uint64_t page_size = sysconf(_SC_PAGESIZE);
+  uint64_t total_size = round_up(file_size + SOURCE_PADDING, page_size);
+
+  // Reserve zero pages for the whole range first, then map the file over the
+  // front of it. The kernel zero-fills the tail of the file's last page, and
+  // the anonymous pages after it supply the rest of the padding.
+  void *base = mmap(nullptr, total_size, PROT_READ,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (base == MAP_FAILED) {
+    close(fd);
+    return false;
+  }
+
+  if (file_size > 0 &&
+      mmap(base, file_size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) ==
+          MAP_FAILED) {
+    munmap(base, total_size);
+    close(fd);
+    return false;
+  }
+  close(fd);
+
+  madvise(base, total_size, MADV_SEQUENTIAL);
+  data = (const char *)base;
+  size = file_size;
+  mapped_size = total_size;
+  return true;
+}
+
+void SourceFile::load_string(const char *str) {
+  uint64_t len = strlen(str);
+  char *buffer = new char[len + SOURCE_PADDING];
+  memcpy(buffer, str, len);
+  memset(buffer + len, 0, SOURCE_PADDING);
+  data = buffer;
+  size = len;
+  mapped_size = 0;
+}
+
+void SourceFile::free() {
+  if (mapped_size != 0) {
+    munmap((void *)data, mapped_size);
+  } else {
+    delete[] data;
+  }
+  data = nullptr;
+  size = mapped_size = 0;
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include "util.h"
+#include <cstdint>
+
+// Every source buffer is followed by at least this many zero bytes. The
+// first one acts as a NUL sentinel for the lexer's inner loops, and the rest
+// let the vector scanners load whole registers past the last real byte.
+#define SOURCE_PADDING 64
+
+// Input text for the lexer. Files are mapped read-only instead of being
+// copied; the mapping is extended with zero pages so the padding guarantee
+// holds even when the file size is a multiple of the page size.
+// This is a pass-by-reference/pointer datastructure.
+struct SourceFile {
+  const char *data = nullptr;
+  uint64_t size = 0;
+  uint64_t mapped_size = 0; // 0 when the buffer is heap allocated
+
+  SourceFile() noexcept = default;
+  SourceFile &operator=(const SourceFile &) = delete;
+  SourceFile(SourceFile &other) = delete;
+  SourceFile(SourceFile &&other) = delete;
+  ~SourceFile() = default;
+
+  // Returns false and leaves errno set if the file can't be mapped.
+  bool load(const char *path);
+  // Copies a NUL-terminated string into a padded buffer.
+  void load_string(const char *str);
+  void free();
+
+  String view() const { return String{data, size}; }
+};
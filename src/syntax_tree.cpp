@@ -1,84 +1,272 @@
 #include "syntax_tree.h"
+#include <algorithm>
 #include <ostream>
 
-std::ostream &operator<<(std::ostream &os, const Stmt &stmt) {
-  switch (stmt.type) {
+uint32_t Program::add_expr(ExprType type, uint32_t a, uint32_t b, Span span) {
+  exprs.push_back(Expr{type, InferredType::Unknown, a, b});
+  expr_spans.push_back(span);
+  return exprs.size() - 1;
+}
+
+uint32_t Program::add_value(ExprType type, uint64_t value, Span span) {
+  return add_expr(type, (uint32_t)value, (uint32_t)(value >> 32), span);
+}
+
+void Program::add_statement(StmtType type, uint32_t a, uint32_t b,
+                            Span span) {
+  statements.push_back(Stmt{type, a, b});
+  statement_spans.push_back(span);
+}
+
+void Stmt::relocate(NodeCounts delta) {
+  switch (type) {
   case StmtType::Pass:
-    return os << "pass";
+    break;
   case StmtType::Expr:
-    return os << stmt.expr;
+  case StmtType::Return:
+    a += delta.exprs;
+    break;
   case StmtType::Assign:
-    return os << "Assign( " << stmt.assign_target << " = " << stmt.assign_value
-              << " )";
+    a += delta.exprs;
+    b += delta.exprs;
+    break;
+  case StmtType::Def:
+    a += delta.functions;
+    break;
   }
+}
 
-  return os;
+NodeCounts Program::copy_nodes(const Program &from, NodeRange range,
+                               NodeCounts at,
+                               const uint32_t *identifier_map) {
+  NodeCounts delta = {at.exprs - range.begin.exprs,
+                      at.extra - range.begin.extra,
+                      at.functions - range.begin.functions,
+                      at.body_statements - range.begin.body_statements};
+
+  for (uint32_t i = range.begin.extra; i < range.end.extra; i++) {
+    extra[i + delta.extra] = from.extra[i] + delta.exprs;
+  }
+  std::copy(from.expr_spans.begin() + range.begin.exprs,
+            from.expr_spans.begin() + range.end.exprs,
+            expr_spans.begin() + at.exprs);
+  for (uint32_t i = range.begin.exprs; i < range.end.exprs; i++) {
+    Expr expr = from.exprs[i];
+    switch (expr.type) {
+    case ExprType::None:
+    case ExprType::Int:
+    case ExprType::Float:
+      break;
+    case ExprType::Ident:
+      if (identifier_map != nullptr) {
+        expr.a = identifier_map[expr.a];
+      }
+      break;
+    case ExprType::Tup:
+      expr.a += delta.extra;
+      break;
+    case ExprType::Neg:
+    case ExprType::Deref:
+    case ExprType::Range:
+    case ExprType::RangePrefix:
+    case ExprType::RangePostfix:
+      expr.a += delta.exprs;
+      break;
+    default: // Call, binary ops and Attr
+      expr.a += delta.exprs;
+      expr.b += delta.exprs;
+      break;
+    }
+    exprs[i + delta.exprs] = expr;
+  }
+
+  for (uint32_t i = range.begin.functions; i < range.end.functions; i++) {
+    Function function = from.functions[i];
+    function.name += delta.exprs;
+    function.params += delta.extra;
+    if (function.body_begin < range.begin.body_statements ||
+        function.body_begin >= range.end.body_statements) {
+      function.parsed = false;
+      function.body_begin = function.body_count = 0;
+    } else {
+      function.body_begin += delta.body_statements;
+    }
+    functions[i + delta.functions] = function;
+  }
+  for (uint32_t i = range.begin.body_statements;
+       i < range.end.body_statements; i++) {
+    Stmt stmt = from.body_statements[i];
+    stmt.relocate(delta);
+    body_statements[i + delta.body_statements] = stmt;
+  }
+  std::copy(from.body_statement_spans.begin() + range.begin.body_statements,
+            from.body_statement_spans.begin() + range.end.body_statements,
+            body_statement_spans.begin() + at.body_statements);
+  return delta;
+}
+
+NodeCounts Program::append_nodes(const Program &from, NodeRange range) {
+  NodeCounts at = node_counts();
+  exprs.resize(at.exprs + range.end.exprs - range.begin.exprs);
+  expr_spans.resize(exprs.size());
+  extra.resize(at.extra + range.end.extra - range.begin.extra);
+  functions.resize(at.functions + range.end.functions -
+                   range.begin.functions);
+  body_statements.resize(at.body_statements + range.end.body_statements -
+                         range.begin.body_statements);
+  body_statement_spans.resize(body_statements.size());
+  return copy_nodes(from, range, at);
 }
 
-std::ostream &operator<<(std::ostream &os, const Expr &expr) {
+void Program::truncate_nodes(NodeCounts counts) {
+  exprs.resize(counts.exprs);
+  expr_spans.resize(counts.exprs);
+  extra.resize(counts.extra);
+  functions.resize(counts.functions);
+  body_statements.resize(counts.body_statements);
+  body_statement_spans.resize(counts.body_statements);
+}
+
+uint64_t Program::bytes() const {
+  return exprs.bytes() + expr_spans.bytes() + extra.bytes() +
+         statements.bytes() + statement_spans.bytes() + functions.bytes() +
+         body_statements.bytes() + body_statement_spans.bytes();
+}
+
+struct ExprPrinter {
+  const Program &program;
+  uint32_t expr;
+};
+
+static std::ostream &operator<<(std::ostream &os, const ExprPrinter &printer) {
+  const Program &program = printer.program;
+  const Expr &expr = program.exprs[printer.expr];
+  auto child = [&](uint32_t idx) { return ExprPrinter{program, idx}; };
+
   switch (expr.type) {
   case ExprType::None:
     return os << "None";
   case ExprType::Int:
-    return os << "i(" << expr.int_value << ")";
+    return os << "i(" << expr.int_value() << ")";
   case ExprType::Float:
-    return os << "f(" << expr.float_value << ")";
+    return os << "f(" << expr.float_value() << ")";
   case ExprType::Ident:
-    return os << "id(" << expr.ident << ")";
+    return os << "id(" << expr.ident() << ")";
   case ExprType::Call: {
-    os << "call<" << *expr.callee << ">( ";
-    int i = 0;
-    for (Expr *e = expr.call_tup_begin; e != expr.call_tup_end; e++) {
-      os << *e << ",";
+    os << "call<" << child(expr.callee()) << ">( ";
+    const Expr &args = program.exprs[expr.b];
+    for (const uint32_t *e = program.children_begin(args);
+         e != program.children_end(args); e++) {
+      os << child(*e) << ",";
     }
     return os << " )";
   }
   case ExprType::Tup: {
     os << "tup( ";
-    int i = 0;
-    for (Expr *e = expr.tup_begin; e != expr.tup_end; e++) {
-      os << *e << ",";
+    for (const uint32_t *e = program.children_begin(expr);
+         e != program.children_end(expr); e++) {
+      os << child(*e) << ",";
     }
     return os << " )";
   }
   case ExprType::Add:
-    return os << "Add( " << *expr.left << ", " << *expr.right << " )";
+    return os << "Add( " << child(expr.left()) << ", " << child(expr.right())
+              << " )";
   case ExprType::Sub:
-    return os << "Sub( " << *expr.left << ", " << *expr.right << " )";
+    return os << "Sub( " << child(expr.left()) << ", " << child(expr.right())
+              << " )";
   case ExprType::Mul:
-    return os << "Mul( " << *expr.left << ", " << *expr.right << " )";
+    return os << "Mul( " << child(expr.left()) << ", " << child(expr.right())
+              << " )";
   case ExprType::Div:
-    return os << "Div( " << *expr.left << ", " << *expr.right << " )";
+    return os << "Div( " << child(expr.left()) << ", " << child(expr.right())
+              << " )";
   case ExprType::Mod:
-    return os << "Mod( " << *expr.left << ", " << *expr.right << " )";
+    return os << "Mod( " << child(expr.left()) << ", " << child(expr.right())
+              << " )";
+  case ExprType::FloorDiv:
+    return os << "FloorDiv( " << child(expr.left()) << ", "
+              << child(expr.right()) << " )";
+  case ExprType::Pow:
+    return os << "Pow( " << child(expr.left()) << ", " << child(expr.right())
+              << " )";
+  case ExprType::Neg:
+    return os << "Neg( " << child(expr.operand()) << " )";
+  case ExprType::Attr:
+    return os << "Attr( " << child(expr.left()) << ", " << child(expr.right())
+              << " )";
   case ExprType::Eq:
-    return os << "Eq( " << *expr.left << ", " << *expr.right << " )";
+    return os << "Eq( " << child(expr.left()) << ", " << child(expr.right())
+              << " )";
   case ExprType::Neq:
-    return os << "Neq( " << *expr.left << ", " << *expr.right << " )";
+    return os << "Neq( " << child(expr.left()) << ", " << child(expr.right())
+              << " )";
   case ExprType::Leq:
-    return os << "Leq( " << *expr.left << ", " << *expr.right << " )";
+    return os << "Leq( " << child(expr.left()) << ", " << child(expr.right())
+              << " )";
   case ExprType::Geq:
-    return os << "Geq( " << *expr.left << ", " << *expr.right << " )";
+    return os << "Geq( " << child(expr.left()) << ", " << child(expr.right())
+              << " )";
   case ExprType::Gt:
-    return os << "Gt( " << *expr.left << ", " << *expr.right << " )";
+    return os << "Gt( " << child(expr.left()) << ", " << child(expr.right())
+              << " )";
   case ExprType::Lt:
-    return os << "Lt( " << *expr.left << ", " << *expr.right << " )";
+    return os << "Lt( " << child(expr.left()) << ", " << child(expr.right())
+              << " )";
   case ExprType::Deref:
-    return os << "Deref( " << *expr.operand << " )";
+    return os << "Deref( " << child(expr.operand()) << " )";
   case ExprType::Range:
-    return os << "Range( " << *expr.operand << " )";
+    return os << "Range( " << child(expr.operand()) << " )";
   case ExprType::RangePrefix:
-    return os << "RangePrefix( " << *expr.operand << " )";
+    return os << "RangePrefix( " << child(expr.operand()) << " )";
   case ExprType::RangePostfix:
-    return os << "RangePostfix( " << *expr.operand << " )";
+    return os << "RangePostfix( " << child(expr.operand()) << " )";
+  }
+  return os;
+}
+
+struct StmtPrinter {
+  const Program &program;
+  const Stmt &stmt;
+};
+
+static std::ostream &operator<<(std::ostream &os, const StmtPrinter &printer) {
+  const Program &program = printer.program;
+  const Stmt &stmt = printer.stmt;
+  switch (stmt.type) {
+  case StmtType::Pass:
+    return os << "pass";
+  case StmtType::Expr:
+    return os << ExprPrinter{program, stmt.expr()};
+  case StmtType::Assign:
+    return os << "Assign( " << ExprPrinter{program, stmt.assign_target()}
+              << " = " << ExprPrinter{program, stmt.assign_value()} << " )";
+  case StmtType::Return:
+    return os << "Return( " << ExprPrinter{program, stmt.expr()} << " )";
+  case StmtType::Def: {
+    const Function &function = program.functions[stmt.function()];
+    os << "def<" << ExprPrinter{program, function.name} << ">( ";
+    for (uint32_t i = 0; i < function.param_count; i++) {
+      os << ExprPrinter{program, program.extra[function.params + i]} << ",";
+    }
+    if (!function.parsed) {
+      return os << " ) [ ... ]";
+    }
+    os << " ) [ ";
+    for (uint32_t i = function.body_begin;
+         i < function.body_begin + function.body_count; i++) {
+      os << StmtPrinter{program, program.body_statements[i]} << ", ";
+    }
+    return os << " ]";
+  }
   }
   return os;
 }
 
 std::ostream &operator<<(std::ostream &os, const Program &program) {
   os << "[ ";
-  for (const Stmt &s : program.statements) {
-    os << s << ", ";
+  for (const Stmt &stmt : program.statements) {
+    os << StmtPrinter{program, stmt} << ", ";
   }
   return os << " ]";
 }
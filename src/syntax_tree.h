@@ -1,8 +1,12 @@
 #pragma once
 #include "util.h"
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <type_traits>
 #include <vector>
 
-enum class ExprType {
+enum class ExprType : uint8_t {
   None,
   Int,
   Float,
@@ -14,6 +18,10 @@ enum class ExprType {
   Mul,
   Div,
   Mod,
+  FloorDiv,
+  Pow,
+  Neg,
+  Attr,
   Leq,
   Geq,
   Lt,
@@ -26,42 +34,38 @@ enum class ExprType {
   RangePostfix
 };
 
-enum class InferredType { Unknown, None, Int, Float };
+enum class InferredType : uint8_t { Unknown, None, Int, Float };
 
+// Nodes refer to each other by index into Program::exprs, and lists of
+// children live in Program::extra, so a Program has no pointers in it and
+// can be moved or written out as-is. What `a` and `b` hold depends on the
+// type:
+//   Int, Float               the 64 bit value, low half in `a`
+//   Ident                    a = identifier id
+//   Tup                      a = first child in extra, b = child count
+//   Call                     a = callee, b = a Tup of the arguments
+//   Neg and other unary ops  a = operand
+//   binary ops, Attr         a = left, b = right
 struct Expr {
   ExprType type;
   InferredType inferred_type;
-  union {
-    uint64_t int_value;
-    double float_value;
-    uint32_t ident;
-    struct {
-      Expr *callee;
-      Expr *call_tup_begin, *call_tup_end;
-    };
-    struct {
-      Expr *tup_begin, *tup_end;
-    };
-    struct {
-      Expr *left, *right;
-    };
-    struct {
-      Expr *operand;
-    };
-  };
+  uint32_t a, b;
 
-  Expr() : type(ExprType::None), inferred_type(InferredType::Unknown) {}
-  Expr(ExprType _type) : type(_type), inferred_type(InferredType::Unknown) {}
-  Expr(ExprType _type, Expr *a, Expr *b)
-      : type(_type), inferred_type(InferredType::Unknown), left(a), right(b) {}
-  Expr(uint64_t i)
-      : type(ExprType::Int), inferred_type(InferredType::Int), int_value(i) {}
-  Expr(double i)
-      : type(ExprType::Float), inferred_type(InferredType::Float),
-        float_value(i) {}
+  uint64_t int_value() const { return a | (uint64_t)b << 32; }
+  double float_value() const {
+    double value;
+    uint64_t bits = int_value();
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+  }
+  uint32_t ident() const { return a; }
+  uint32_t operand() const { return a; }
+  uint32_t left() const { return a; }
+  uint32_t right() const { return b; }
+  uint32_t callee() const { return a; }
 };
 
-enum class TypeType { Int, Float, Func };
+enum class TypeType { Unknown, None, Int, Float, Func };
 struct Type {
   TypeType type;
   union {
@@ -72,29 +76,229 @@ struct Type {
   };
 };
 
-enum class StmtType { Pass, Expr, Assign };
+enum class StmtType : uint8_t { Pass, Expr, Assign, Def, Return };
+
+// Sizes of, or positions in, the node arrays of a Program.
+struct NodeCounts {
+  uint32_t exprs, extra, functions, body_statements;
+};
+
+// For Expr and Return statements `a` is the expression (a None node for a
+// bare return); for Assign, `a` is the target and `b` the value; for Def,
+// `a` indexes Program::functions.
 struct Stmt {
   StmtType type;
-  union {
-    Expr expr;
-    struct {
-      Expr assign_target, assign_value;
-    };
-  };
+  uint32_t a, b;
+
+  uint32_t expr() const { return a; }
+  uint32_t assign_target() const { return a; }
+  uint32_t assign_value() const { return b; }
+  uint32_t function() const { return a; }
+
+  // Moves the nodes this refers to along by `delta`.
+  void relocate(NodeCounts delta);
+};
+
+// Byte offsets into the source for top-level statements. Expression spans
+// are relative to the start of their statement, and the spans of statements
+// in a def body, and of the body itself, to the start of the top-level
+// statement they're in, so a top-level statement can move without touching
+// its nodes. A parenthesized expression's span includes the parentheses.
+struct Span {
+  uint32_t begin, end;
+};
+
+// A def. `name` is an Ident node, and so is each parameter; their indices
+// are in `extra`. Once parsed, the body is `body_count` statements from
+// `body_begin` in Program::body_statements. When the parser defers bodies it
+// only records `body`, from the first indented line to the end of the last
+// statement, and `indentation`, the width of the def line's indentation;
+// Parser::parse_body fills in the rest when the body is needed.
+struct Function {
+  uint32_t name;
+  uint32_t params, param_count;
+  uint32_t body_begin, body_count;
+  Span body;
+  uint32_t indentation;
+  bool parsed;
+};
+
+// The nodes of one statement, or a run of statements: parsing a statement
+// only appends, so its nodes are contiguous in every array. Bodies parsed
+// later by Parser::parse_body are the exception; they end up at the end of
+// the arrays.
+struct NodeRange {
+  NodeCounts begin, end;
+};
 
-  Stmt() : type(StmtType::Pass) {}
-  Stmt(Expr &_expr) : type(StmtType::Expr), expr(_expr) {}
+// A growable array of nodes, like std::vector, that can also be pointed at
+// memory it doesn't own, such as a private mapping of a cache file. It reads
+// and writes borrowed memory in place, and only copies the nodes to a heap
+// buffer of its own the first time it has to grow. Only the heap buffer is
+// ever freed.
+// This is a pass-by-reference/pointer datastructure.
+template <class T> struct NodeArray {
+  static_assert(std::is_trivially_copyable<T>::value,
+                "nodes are moved around as bytes");
 
-  Stmt &operator=(StmtType i) {
-    type = i;
+  T *items = nullptr;
+  uint32_t count = 0;
+  uint32_t capa = 0;
+  bool owned = true;
+
+  NodeArray() noexcept = default;
+  NodeArray &operator=(const NodeArray &) = delete;
+  NodeArray(const NodeArray &other) = delete;
+  NodeArray(NodeArray &&other) noexcept { take(other); }
+  NodeArray &operator=(NodeArray &&other) noexcept {
+    if (this != &other) {
+      free();
+      take(other);
+    }
     return *this;
   }
+  ~NodeArray() { free(); }
+
+  // Uses `size` nodes at `data` in place. They have to stay valid, and
+  // writable, until this array grows or is freed.
+  void borrow(T *data, uint32_t size) {
+    free();
+    items = data;
+    count = capa = size;
+    owned = false;
+  }
+
+  void free() {
+    if (owned) {
+      ::free(items);
+    }
+    items = nullptr;
+    count = capa = 0;
+    owned = true;
+  }
+
+  uint32_t size() const { return count; }
+  bool empty() const { return count == 0; }
+  uint32_t capacity() const { return capa; }
+  // Heap memory held; borrowed memory doesn't count.
+  uint64_t bytes() const { return owned ? (uint64_t)capa * sizeof(T) : 0; }
+
+  T *data() { return items; }
+  const T *data() const { return items; }
+  T *begin() { return items; }
+  T *end() { return items + count; }
+  const T *begin() const { return items; }
+  const T *end() const { return items + count; }
+  T &operator[](uint32_t idx) { return items[idx]; }
+  const T &operator[](uint32_t idx) const { return items[idx]; }
+  T &back() { return items[count - 1]; }
+
+  void reserve(uint32_t size) {
+    if (size > capa) {
+      reallocate(size);
+    }
+  }
+
+  // New nodes are zeroed, like std::vector value-initializes them.
+  void resize(uint32_t size) {
+    reserve(size);
+    if (size > count) {
+      memset((void *)(items + count), 0, (uint64_t)(size - count) * sizeof(T));
+    }
+    count = size;
+  }
+
+  void push_back(const T &item) {
+    if (count == capa) {
+      reallocate(capa < 8 ? 8 : capa * 2);
+    }
+    items[count++] = item;
+  }
+
+  void append(const T *first, const T *last) {
+    uint32_t added = last - first;
+    if (added == 0) {
+      return;
+    }
+    if (count + added > capa) {
+      reallocate(count + added > capa * 2 ? count + added : capa * 2);
+    }
+    memcpy((void *)(items + count), first, (uint64_t)added * sizeof(T));
+    count += added;
+  }
+
+  void clear() { count = 0; }
+
+  void reallocate(uint32_t new_capa) {
+    T *fresh;
+    if (owned) {
+      fresh = (T *)realloc((void *)items, (uint64_t)new_capa * sizeof(T));
+    } else {
+      fresh = (T *)malloc((uint64_t)new_capa * sizeof(T));
+      memcpy((void *)fresh, items, (uint64_t)count * sizeof(T));
+    }
+    if (fresh == nullptr) {
+      throw std::bad_alloc();
+    }
+    items = fresh;
+    capa = new_capa;
+    owned = true;
+  }
+
+  void take(NodeArray &other) {
+    items = other.items;
+    count = other.count;
+    capa = other.capa;
+    owned = other.owned;
+    other.items = nullptr;
+    other.count = other.capa = 0;
+    other.owned = true;
+  }
 };
 
+// Children are always added before their parents, so `exprs` is in
+// post-order and a bottom-up pass is a plain loop over it.
 struct Program {
-  std::vector<Stmt> statements;
+  NodeArray<Expr> exprs;
+  NodeArray<Span> expr_spans;
+  NodeArray<uint32_t> extra;
+  NodeArray<Stmt> statements;
+  NodeArray<Span> statement_spans;
+  NodeArray<Function> functions;
+  NodeArray<Stmt> body_statements;
+  NodeArray<Span> body_statement_spans;
+
+  uint32_t add_expr(ExprType type, uint32_t a, uint32_t b, Span span);
+  uint32_t add_value(ExprType type, uint64_t value, Span span);
+  void add_statement(StmtType type, uint32_t a, uint32_t b, Span span);
+
+  NodeCounts node_counts() const {
+    return NodeCounts{(uint32_t)exprs.size(), (uint32_t)extra.size(),
+                      (uint32_t)functions.size(),
+                      (uint32_t)body_statements.size()};
+  }
+  // Copies the nodes in `range` of `from` to the already allocated slots at
+  // `at`, fixing up the indices between them, and identifier ids through
+  // `identifier_map` if there is one. A body outside `range` isn't copied;
+  // its function goes back to unparsed. Returns how far the nodes moved,
+  // for Stmt::relocate; it wraps around when they moved down.
+  NodeCounts copy_nodes(const Program &from, NodeRange range, NodeCounts at,
+                        const uint32_t *identifier_map = nullptr);
+  // Same, to the end of this program.
+  NodeCounts append_nodes(const Program &from, NodeRange range);
+  // Drops the nodes past `counts`.
+  void truncate_nodes(NodeCounts counts);
+
+  // What the arrays have reserved on the heap.
+  uint64_t bytes() const;
+
+  // Children of a Tup.
+  const uint32_t *children_begin(const Expr &expr) const {
+    return extra.data() + expr.a;
+  }
+  const uint32_t *children_end(const Expr &expr) const {
+    return extra.data() + expr.a + expr.b;
+  }
 };
 
-std::ostream &operator<<(std::ostream &os, const Stmt &stmt);
-std::ostream &operator<<(std::ostream &os, const Expr &expr);
 std::ostream &operator<<(std::ostream &os, const Program &program);
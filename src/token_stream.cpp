@@ -0,0 +1,56 @@
+#include "token_stream.h"
+
+TokenStream::TokenStream(String _data, StringInterner *_identifiers)
+    : data(_data), identifiers(_identifiers) {}
+
+void TokenStream::reserve(uint32_t count) {
+  types.reserve(count);
+  offsets.reserve(count);
+  values.reserve(count);
+}
+
+void TokenStream::discard(uint32_t count) {
+  uint32_t kept_numbers = 0;
+  for (uint32_t i = count; i < size(); i++) {
+    if (types[i] == TokenType::INTEGER ||
+        types[i] == TokenType::FLOATING_POINT) {
+      numbers[kept_numbers] = numbers[values[i]];
+      values[i] = kept_numbers++;
+    }
+  }
+  numbers.resize(kept_numbers);
+  types.erase(types.begin(), types.begin() + count);
+  offsets.erase(offsets.begin(), offsets.begin() + count);
+  values.erase(values.begin(), values.begin() + count);
+}
+
+String TokenStream::view(uint32_t i) const {
+  const char *begin = data.begin + offsets[i];
+  switch (types[i]) {
+  case TokenType::IDENT:
+    return String{begin, identifiers->get(values[i]).size()};
+  case TokenType::INTEGER:
+  case TokenType::FLOATING_POINT:
+    return String{begin, numbers[values[i]].length};
+  default:
+    return String{begin, values[i]};
+  }
+}
+
+Token TokenStream::get(uint32_t i) const {
+  Token tok;
+  tok.type = types[i];
+  tok.view = view(i);
+  switch (tok.type) {
+  case TokenType::IDENT:
+    tok.identifier_idx = values[i];
+    break;
+  case TokenType::INTEGER:
+  case TokenType::FLOATING_POINT:
+    tok.integer_value = numbers[values[i]].integer_value;
+    break;
+  default:
+    break;
+  }
+  return tok;
+}
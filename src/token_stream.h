@@ -0,0 +1,62 @@
+#pragma once
+#include "interner.h"
+#include "lexer.h"
+#include <vector>
+
+// Tokens stored column-wise: a 1 byte type, a 32 bit offset into `data` and
+// a 32 bit value word, 9 bytes per token where a Token takes 32. Code that
+// only dispatches on types, like the parser, reads nothing but `types`.
+//
+// The value word is the length of the token's text, except for IDENT, where
+// it's the identifier id (the interned copy has the same length), and for
+// INTEGER and FLOATING_POINT, where it indexes `numbers`.
+struct TokenStream {
+  struct Number {
+    union {
+      uint64_t integer_value;
+      double floating_value;
+    };
+    uint32_t length;
+  };
+
+  String data;
+  StringInterner *identifiers;
+  std::vector<TokenType> types;
+  std::vector<uint32_t> offsets;
+  std::vector<uint32_t> values;
+  std::vector<Number> numbers;
+
+  TokenStream(String data, StringInterner *identifiers);
+
+  uint32_t size() const { return types.size(); }
+  void reserve(uint32_t count);
+  // Inline since the parser calls it for every token it lexes.
+  void push(const Token &tok) {
+    types.push_back(tok.type);
+    offsets.push_back(tok.view.begin - data.begin);
+    if (tok.type == TokenType::IDENT) {
+      values.push_back(tok.identifier_idx);
+    } else if (tok.type == TokenType::INTEGER ||
+               tok.type == TokenType::FLOATING_POINT) {
+      Number number;
+      number.integer_value = tok.integer_value;
+      number.length = tok.view.end - tok.view.begin;
+      values.push_back(numbers.size());
+      numbers.push_back(number);
+    } else {
+      values.push_back(tok.view.end - tok.view.begin);
+    }
+  }
+  // Drops the first `count` tokens; the rest move to the front.
+  void discard(uint32_t count);
+
+  uint32_t identifier(uint32_t i) const { return values[i]; }
+  uint64_t integer(uint32_t i) const {
+    return numbers[values[i]].integer_value;
+  }
+  double floating(uint32_t i) const {
+    return numbers[values[i]].floating_value;
+  }
+  String view(uint32_t i) const;
+  Token get(uint32_t i) const;
+};
@@ -1,4 +1,5 @@
 #include "typechecking.h"
+#include <assert.h>
 
 // Propogate
 #define prop(expr)                                                             \
@@ -18,46 +19,161 @@
     return false;                                                              \
   }
 
-SymbolTable::SymbolTable(BucketArray *buckets)
-    : symbols(buckets, 10, sizeof(Type)) {}
+SymbolTable::SymbolTable(BucketArray *buckets) : symbols(buckets, 10) {}
 
-TypeChecker::TypeChecker(BucketArray *buckets) {}
+void SymbolTable::push_scope() { scopes.push_back(undo.size()); }
 
-bool TypeChecker::check_program(Program *program) {
-  for (Stmt &stmt : program->statements) {
-    prop(check_statement(&stmt));
+void SymbolTable::pop_scope() {
+  uint32_t begin = scopes.back();
+  scopes.pop_back();
+  while (undo.size() > begin) {
+    const Shadowed &shadowed = undo.back();
+    if (shadowed.bound) {
+      *symbols.find(shadowed.name) = shadowed.type;
+    } else {
+      symbols.remove(shadowed.name);
+    }
+    undo.pop_back();
+  }
+}
+
+void SymbolTable::declare(uint32_t name, Type type) {
+  uint32_t size = symbols.size;
+  Type *slot = symbols.insert(name);
+  // Bindings outside of any scope are never undone.
+  if (!scopes.empty()) {
+    undo.push_back(symbols.size == size ? Shadowed{name, true, *slot}
+                                        : Shadowed{name, false, Type()});
+  }
+  *slot = type;
+}
+
+Type *SymbolTable::find(uint32_t name) { return symbols.find(name); }
+
+static Type type_of(TypeType type_type) {
+  Type type = {};
+  type.type = type_type;
+  return type;
+}
+
+static Type type_of(InferredType inferred) {
+  switch (inferred) {
+  case InferredType::None:
+    return type_of(TypeType::None);
+  case InferredType::Int:
+    return type_of(TypeType::Int);
+  case InferredType::Float:
+    return type_of(TypeType::Float);
+  default:
+    return type_of(TypeType::Unknown);
+  }
+}
+
+static InferredType inferred_type_of(const Type &type) {
+  switch (type.type) {
+  case TypeType::None:
+    return InferredType::None;
+  case TypeType::Int:
+    return InferredType::Int;
+  case TypeType::Float:
+    return InferredType::Float;
+  default:
+    return InferredType::Unknown;
+  }
+}
+
+TypeChecker::TypeChecker(BucketArray *buckets) : symbols(buckets) {}
+
+bool TypeChecker::check_program(Program *_program, Parser *_parser) {
+  program = _program;
+  parser = _parser;
+  if (parser != nullptr) {
+    parser->program = program;
+  }
+  for (uint32_t i = 0; i < program->statements.size(); i++) {
+    statement_base = program->statement_spans[i].begin;
+    prop(check_statement(program->statements[i]));
   }
   return true;
 }
 
-bool TypeChecker::check_statement(Stmt *stmt) {
-  switch (stmt->type) {
+bool TypeChecker::check_statement(const Stmt &stmt) {
+  switch (stmt.type) {
   case StmtType::Pass:
     return true;
   case StmtType::Expr:
-    prop(check_expr(&stmt->expr));
+  case StmtType::Return:
+    prop(check_expr(stmt.expr()));
     break;
-  case StmtType::Assign:
+  case StmtType::Assign: {
+    prop(check_expr(stmt.assign_value()));
+    const Expr &target = program->exprs[stmt.assign_target()];
+    if (target.type == ExprType::Ident) {
+      InferredType value = program->exprs[stmt.assign_value()].inferred_type;
+      symbols.declare(target.ident(), type_of(value));
+    }
+    break;
+  }
+  case StmtType::Def: {
+    // Declared before the body is checked, so the body can call it.
+    uint32_t name = program->functions[stmt.function()].name;
+    symbols.declare(program->exprs[name].ident(), type_of(TypeType::Func));
+    prop(check_function(stmt.function()));
     break;
   }
+  }
+  return true;
+}
+
+bool TypeChecker::check_function(uint32_t function) {
+  if (!program->functions[function].parsed) {
+    assert(parser != nullptr);
+    prop_err(parser->parse_body(function, statement_base),
+             parser->error.location, parser->error.message);
+  }
+
+  // Checking the body can parse nested bodies, which moves body_statements.
+  const Function &f = program->functions[function];
+  uint32_t begin = f.body_begin, end = f.body_begin + f.body_count;
+  symbols.push_scope();
+  for (uint32_t i = 0; i < f.param_count; i++) {
+    uint32_t param = program->extra[f.params + i];
+    symbols.declare(program->exprs[param].ident(), type_of(TypeType::Unknown));
+  }
+  for (uint32_t i = begin; i < end; i++) {
+    Stmt stmt = program->body_statements[i];
+    if (!check_statement(stmt)) {
+      symbols.pop_scope();
+      return false;
+    }
+  }
+  symbols.pop_scope();
   return true;
 }
 
-bool TypeChecker::check_expr(Expr *expr) {
-  if (expr->inferred_type != InferredType::Unknown) {
+bool TypeChecker::check_expr(uint32_t idx) {
+  Expr &expr = program->exprs[idx];
+  if (expr.inferred_type != InferredType::Unknown) {
     return true;
   }
 
-  switch (expr->type) {
+  switch (expr.type) {
   case ExprType::None:
-    expr->inferred_type = InferredType::None;
+    expr.inferred_type = InferredType::None;
     break;
   case ExprType::Int:
-    expr->inferred_type = InferredType::Int;
+    expr.inferred_type = InferredType::Int;
     break;
   case ExprType::Float:
-    expr->inferred_type = InferredType::Float;
+    expr.inferred_type = InferredType::Float;
+    break;
+  case ExprType::Ident: {
+    Type *type = symbols.find(expr.ident());
+    if (type != nullptr) {
+      expr.inferred_type = inferred_type_of(*type);
+    }
     break;
   }
+  }
   return true;
 }
@@ -1,14 +1,36 @@
 #pragma once
 
+#include "hash.h"
+#include "parser.h"
 #include "syntax_tree.h"
 #include "util.h"
 #include <vector>
 
+// Names in scope while checking, keyed by identifier id. One flat table
+// holds the innermost binding of every name, so a lookup is one probe
+// however deeply scopes nest. Declaring a name logs the binding it replaces,
+// and leaving a scope replays its part of the log backwards, so entering and
+// leaving cost only the scope's own declarations.
 struct SymbolTable {
-  Hash symbols;
-  SymbolTable *parent;
+  struct Shadowed {
+    uint32_t name;
+    bool bound; // whether `name` had a binding before
+    Type type;
+  };
+
+  Hash<uint32_t, Type> symbols;
+  std::vector<Shadowed> undo;
+  // undo.size() when each open scope was entered.
+  std::vector<uint32_t> scopes;
 
   SymbolTable(BucketArray *buckets);
+
+  void push_scope();
+  void pop_scope();
+  // Binds `name` in the innermost scope, shadowing any outer binding. With no
+  // scope open the binding is never undone.
+  void declare(uint32_t name, Type type);
+  Type *find(uint32_t name);
 };
 
 struct TypeChecker {
@@ -21,11 +43,17 @@ struct TypeChecker {
 
   TypeCheckError error;
   std::vector<TypeCheckError> warnings;
-  SymbolTable *sym = nullptr;
+  SymbolTable symbols;
+  Program *program = nullptr;
+  // Parses def bodies the parser deferred, the first time they're checked.
+  Parser *parser = nullptr;
+  // Where the top-level statement being checked starts.
+  uint32_t statement_base = 0;
 
-  bool check_program(Program *program);
-  bool check_statement(Stmt *statement);
-  bool check_expr(Expr *expr);
-  bool check_arithmetic(Expr *expr);
-  bool check_comparison(Expr *expr);
+  bool check_program(Program *program, Parser *parser = nullptr);
+  bool check_statement(const Stmt &statement);
+  bool check_function(uint32_t function);
+  bool check_expr(uint32_t expr);
+  bool check_arithmetic(uint32_t expr);
+  bool check_comparison(uint32_t expr);
 };
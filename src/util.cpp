@@ -1,19 +1,20 @@
 #include "util.h"
+#include <algorithm>
 #include <assert.h>
+#include <atomic>
 #include <iostream>
 #include <limits.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <thread>
 
-#define BUCKET_SIZE 1024
+#define BUCKET_MMAP_SIZE (256 * 1024)
+#define PAGE_SIZE 4096
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
 #define DEFAULT_POOL_SIZE 1024
 #define POOL_GROWTH_FACTOR 1.2
 
-#define NULL_KEY 0
-#define TOMBSTONE_KEY INT_MAX
-#define transform_key(key) (key + 1)
-#define invert_transform_key(key) (key - 1)
-
 String::String(const char *s) : begin(s) {
   uint64_t len = strlen(s);
   end = begin + len;
@@ -97,221 +98,273 @@ BucketArray::Bucket Pool::push_to_buckets(BucketArray *buckets) noexcept {
   char *bucket_end = bucket_begin + size;
   memcpy(bucket_begin, begin, size);
   clear();
-  return BucketArray::Bucket{bucket_begin, bucket_end};
+  return BucketArray::Bucket{bucket_begin, bucket_end, bucket_end};
 }
 
 void Pool::clear() noexcept { progress = begin; }
 
-void Pool::free() noexcept {
-  delete begin;
-  begin = progress = end = nullptr;
+// The memory belongs to the BucketArray, and goes away with it.
+void Pool::free() noexcept { begin = progress = end = nullptr; }
+
+static uint64_t round_up(uint64_t size, uint64_t alignment) {
+  return (size + alignment - 1) & ~(alignment - 1);
+}
+
+void BucketArray::release(Bucket bucket) noexcept {
+  uint64_t size = bucket.end - bucket.begin;
+  reserved_bytes -= size;
+  if (size >= BUCKET_MMAP_SIZE) {
+    munmap(bucket.begin, size);
+  } else {
+    delete[] bucket.begin;
+  }
 }
 
 void BucketArray::free() {
-  for (auto bucket_ : buckets) {
-    delete bucket_.begin;
+  for (Bucket bucket : buckets) {
+    release(bucket);
   }
   buckets.clear();
+  release(spare);
+  spare = Bucket{nullptr, nullptr, nullptr};
+  free_lists.clear();
+  free_block_bytes = 0;
 }
 
-char *BucketArray::add(uint64_t size) noexcept {
-  size = (size - 1) / 16 * 16 + 16;
+BucketArray::Mark BucketArray::mark() noexcept {
   if (buckets.size() == 0) {
-    char *begin = new char[BUCKET_SIZE];
-    buckets.push_back(Bucket{begin, begin});
+    return Mark{};
   }
+  return Mark{(uint32_t)buckets.size(), buckets.back()};
+}
 
-  if (size > BUCKET_SIZE) {
-    Bucket old_back = buckets.back();
-    char *begin = new char[size];
-    buckets.back() = Bucket{begin, begin + size};
-    buckets.push_back(old_back);
-    return begin;
+char *BucketArray::add_block(uint64_t size) noexcept {
+  if (size < sizeof(char *)) {
+    size = sizeof(char *);
   }
-
-  Bucket *last_bucket = &buckets.back();
-  if (BUCKET_SIZE - (last_bucket->progress - last_bucket->begin) < size) {
-    char *begin = new char[BUCKET_SIZE];
-    buckets.push_back(Bucket{begin, begin});
-    last_bucket = &buckets.back();
+  for (FreeList &list : free_lists) {
+    if (list.size == size && list.head != nullptr) {
+      char *block = list.head;
+      memcpy(&list.head, block, sizeof(char *));
+      free_block_bytes -= size;
+      return block;
+    }
   }
-
-  char *retLocation = last_bucket->progress;
-  last_bucket->progress += size;
-  return retLocation;
+  return add(size);
 }
 
-// We add 1 to each key before adding to the hash table
-// growth factor is 1/2 always, capacity is always a power of 2
-
-static uint32_t hashword(uint32_t c) {
-  // Bob Jenkin's mix function, possibly overkill for only 32 bits?
-  // but a simpler one was no faster, so what the heck
-  uint32_t a, b;
-  a = b = 0x9e3779b9; /* the golden ratio; an arbitrary value */
-  a -= b;
-  a -= c;
-  a ^= (c >> 13);
-  b -= c;
-  b -= a;
-  b ^= (a << 8);
-  c -= a;
-  c -= b;
-  c ^= (b >> 13);
-  a -= b;
-  a -= c;
-  a ^= (c >> 12);
-  b -= c;
-  b -= a;
-  b ^= (a << 16);
-  c -= a;
-  c -= b;
-  c ^= (b >> 5);
-  a -= b;
-  a -= c;
-  a ^= (c >> 3);
-  b -= c;
-  b -= a;
-  b ^= (a << 10);
-  c -= a;
-  c -= b;
-  c ^= (b >> 15);
-  return c;
+void BucketArray::free_block(char *block, uint64_t size) noexcept {
+  if (size < sizeof(char *)) {
+    size = sizeof(char *);
+  }
+  free_block_bytes += size;
+  for (FreeList &list : free_lists) {
+    if (list.size == size) {
+      memcpy(block, &list.head, sizeof(char *));
+      list.head = block;
+      return;
+    }
+  }
+  char *next = nullptr;
+  memcpy(block, &next, sizeof(char *));
+  free_lists.push_back(FreeList{size, block});
 }
 
-typedef struct {
-  uint32_t key;
-  uint32_t value;
-} Item;
-
-// https://stackoverflow.com/a/365068
-static inline uint32_t pow2roundup(uint32_t x) {
-  x--;
-  x |= x >> 1;
-  x |= x >> 2;
-  x |= x >> 4;
-  x |= x >> 8;
-  x |= x >> 16;
-  return x + 1;
+void BucketArray::rewind(Mark mark) noexcept {
+  // Some free blocks may be in the buckets freed below.
+  free_lists.clear();
+  free_block_bytes = 0;
+
+  // Buckets added since the mark are all from the marked last bucket on,
+  // though dedicated ones may have been put in front of it.
+  uint32_t first = mark.bucket_count == 0 ? 0 : mark.bucket_count - 1;
+  for (uint32_t i = first; i < buckets.size(); i++) {
+    Bucket bucket = buckets[i];
+    if (bucket.begin == mark.last.begin) {
+      continue;
+    }
+    if (bucket.end - bucket.begin > spare.end - spare.begin) {
+      std::swap(bucket, spare);
+    }
+    if (bucket.begin != nullptr) {
+      release(bucket);
+    }
+  }
+
+  buckets.resize(mark.bucket_count);
+  if (mark.bucket_count != 0) {
+    buckets.back() = mark.last;
+  }
 }
 
-static inline void hashGrow(Hash *h, uint32_t data_type) {
-  uint32_t capa2 = h->capa * 2;
-  uint32_t *data = h->data;
-  Hash h2(h->buckets, capa2, data_type);
-  for (int i = 0; i < capa2; i += 2) {
-    if (data[i] != NULL_KEY && data[i] != TOMBSTONE_KEY) {
-      if (data_type <= sizeof(uint32_t)) {
-        *((uint32_t *)h2.insert(invert_transform_key(data[i]), data_type)) =
-            data[i + 1];
-      } else {
-        uint32_t valueIdx = data[i + 1];
-        memcpy(h2.insert(invert_transform_key(data[i]), data_type),
-               ((char *)(&data[capa2])) + valueIdx * data_type, data_type);
-      }
+void BucketArray::adopt(BucketArray *other) noexcept {
+  // Behind the last bucket, so its free space is still used.
+  buckets.insert(buckets.size() == 0 ? buckets.end() : buckets.end() - 1,
+                 other->buckets.begin(), other->buckets.end());
+  uint64_t size = 0;
+  for (Bucket bucket : other->buckets) {
+    size += bucket.end - bucket.begin;
+  }
+  other->buckets.clear();
+
+  allocation_count += other->allocation_count;
+  requested_bytes += other->requested_bytes;
+  padding_bytes += other->padding_bytes;
+  reserved_bytes += size;
+  if (reserved_bytes > peak_reserved_bytes) {
+    peak_reserved_bytes = reserved_bytes;
+  }
+  other->allocation_count = other->requested_bytes = other->padding_bytes = 0;
+  other->reserved_bytes -= size;
+  other->release(other->spare);
+  other->spare = Bucket{nullptr, nullptr, nullptr};
+  for (FreeList list : other->free_lists) {
+    while (list.head != nullptr) {
+      char *block = list.head;
+      memcpy(&list.head, block, sizeof(char *));
+      free_block(block, list.size);
     }
   }
-  *h = h2;
+  other->free_lists.clear();
+  other->free_block_bytes = 0;
 }
 
-Hash::Hash(BucketArray *buckets, uint32_t size, uint32_t data_type) {
-  if (size < 8) {
-    size = 8;
+BucketArray::Bucket BucketArray::new_bucket(uint64_t size) noexcept {
+  if (size >= BUCKET_MMAP_SIZE) {
+    size = round_up(size, huge_pages ? HUGE_PAGE_SIZE : PAGE_SIZE);
+  }
+  reserved_bytes += size;
+  if (reserved_bytes > peak_reserved_bytes) {
+    peak_reserved_bytes = reserved_bytes;
   }
 
-  if (data_type < sizeof(uint32_t)) {
-    data_type = 0;
+  if (size < BUCKET_MMAP_SIZE) {
+    char *begin = new char[size];
+    return Bucket{begin, begin, begin + size};
   }
 
-  this->buckets = buckets;
-  this->capa = pow2roundup(size);
-  this->size = 0;
-  this->data = (uint32_t *)buckets->add(this->capa * sizeof(Item) +
-                                        data_type * (this->capa >> 1));
-  uint32_t capa2 = this->capa * 2;
-  for (uint32_t i = 0; i < capa2; i += 2) {
-    this->data[i] = 0;
+  if (!huge_pages) {
+    void *begin = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (begin == MAP_FAILED) {
+      abort();
+    }
+    return Bucket{(char *)begin, (char *)begin, (char *)begin + size};
   }
-}
 
-void *Hash::find(uint32_t key, uint32_t data_type) {
-  return inlineFind(key, data_type);
-}
-void *Hash::insert(uint32_t key, uint32_t data_type) {
-  return inlineInsert(key, data_type);
-}
-void *Hash::remove(uint32_t key, uint32_t data_type) {
-  return inlineRemove(key, data_type);
+  // Transparent huge pages only back aligned ranges, so map a huge page
+  // extra and trim it off around an aligned one.
+  char *mapping = (char *)mmap(nullptr, size + HUGE_PAGE_SIZE,
+                               PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mapping == MAP_FAILED) {
+    abort();
+  }
+  char *begin = (char *)round_up((uint64_t)mapping, HUGE_PAGE_SIZE);
+  if (begin != mapping) {
+    munmap(mapping, begin - mapping);
+  }
+  munmap(begin + size, mapping + HUGE_PAGE_SIZE - begin);
+  madvise(begin, size, MADV_HUGEPAGE);
+  return Bucket{begin, begin, begin + size};
 }
 
-inline void *Hash::inlineFind(uint32_t key, uint32_t data_type) {
-  if (data_type <= sizeof(uint32_t)) {
-    data_type = 0;
+char *BucketArray::add(uint64_t size, uint64_t alignment) noexcept {
+  allocation_count++;
+  requested_bytes += size;
+  if (buckets.size() != 0) {
+    Bucket &last = buckets.back();
+    uint64_t at = round_up((uint64_t)last.progress, alignment);
+    if (at + size <= (uint64_t)last.end) {
+      padding_bytes += at - (uint64_t)last.progress;
+      last.progress = (char *)at + size;
+      return (char *)at;
+    }
   }
 
-  key = transform_key(key);
-  uint32_t *data = this->data;
-  uint32_t idx = 2 * (hashword(key) & (this->capa - 1));
-  uint32_t capa2 = this->capa * 2;
-
-  for (; data[idx] != NULL_KEY && data[idx] != key;
-       idx += 2, idx = idx >= capa2 ? 0 : idx)
-    ;
+  // new[] and mmap are only guaranteed to align to BUCKET_ALIGNMENT.
+  uint64_t padded = size;
+  if (alignment > BUCKET_ALIGNMENT) {
+    padded += alignment;
+  }
 
-  if (data[idx] == NULL_KEY) {
-    return nullptr;
+  if (padded > bucket_size / 2) {
+    // Put it behind the last bucket, so the last one's free space isn't
+    // lost.
+    Bucket bucket = new_bucket(padded);
+    char *begin = (char *)round_up((uint64_t)bucket.begin, alignment);
+    padding_bytes += begin - bucket.begin;
+    bucket.progress = begin + size;
+    buckets.insert(buckets.size() == 0 ? buckets.end() : buckets.end() - 1,
+                   bucket);
+    return begin;
   }
 
-  uint32_t *valueIdx = &data[idx + 1];
-  if (data_type == 0) {
-    return valueIdx;
+  Bucket bucket;
+  if ((uint64_t)(spare.end - spare.begin) >= bucket_size) {
+    bucket = spare;
+    spare = Bucket{nullptr, nullptr, nullptr};
   } else {
-    return ((char *)(&data[capa2])) + *valueIdx * data_type;
+    bucket = new_bucket(bucket_size);
   }
+  if (bucket_size < max_bucket_size) {
+    bucket_size = bucket_size * 2 < max_bucket_size ? bucket_size * 2
+                                                    : max_bucket_size;
+  }
+  char *begin = (char *)round_up((uint64_t)bucket.begin, alignment);
+  padding_bytes += begin - bucket.begin;
+  bucket.progress = begin + size;
+  buckets.push_back(bucket);
+  return begin;
 }
 
-inline void *Hash::inlineInsert(uint32_t key, uint32_t data_type) {
-  if (data_type <= sizeof(uint32_t)) {
-    data_type = 0;
+BucketArray::Stats BucketArray::stats() const {
+  Stats stats;
+  stats.allocations = allocation_count;
+  stats.requested = requested_bytes;
+  stats.padding = padding_bytes;
+  stats.reserved = reserved_bytes;
+  stats.peak_reserved = peak_reserved_bytes;
+  stats.used = 0;
+  for (Bucket bucket : buckets) {
+    stats.used += bucket.progress - bucket.begin;
   }
+  stats.free_blocks = free_block_bytes;
+  stats.bucket_count = buckets.size();
+  return stats;
+}
 
-  if (this->size * 2 >= this->capa) {
-    hashGrow(this, data_type);
+std::ostream &operator<<(std::ostream &os, const BucketArray::Stats &stats) {
+  os << stats.allocations << " allocations of " << stats.requested
+     << " bytes (" << stats.padding << " padding), " << stats.bucket_count
+     << " buckets, " << stats.used << " of " << stats.reserved
+     << " bytes used (" << stats.free_blocks << " in free blocks), peak "
+     << stats.peak_reserved;
+  if (stats.reserved != 0) {
+    os << ", " << 100.0 * (stats.reserved - stats.used) / stats.reserved
+       << "% unused";
   }
+  return os;
+}
 
-  key = transform_key(key);
-  uint32_t *data = this->data;
-  uint32_t idx = 2 * (hashword(key) & (this->capa - 1));
-  uint32_t capa2 = this->capa * 2;
-
-  for (;
-       data[idx] != NULL_KEY && data[idx] != key && data[idx] != TOMBSTONE_KEY;
-       idx += 2, idx = idx >= capa2 ? 0 : idx)
-    ;
+void parallel_for(uint32_t count, uint32_t thread_count,
+                  const std::function<void(uint32_t)> &job) {
+  std::atomic<uint32_t> next(0);
+  auto worker = [&]() {
+    for (uint32_t i = next++; i < count; i = next++) {
+      job(i);
+    }
+  };
 
-  data[idx] = key;
-  uint32_t *valueIdx = &data[idx + 1];
-  if (data_type == 0) {
-    this->size++;
-    return valueIdx;
-  } else {
-    *valueIdx = this->size++;
-    return ((char *)(&data[capa2])) + *valueIdx * data_type;
+  if (thread_count > count) {
+    thread_count = count;
   }
-}
-
-inline void *Hash::inlineRemove(uint32_t key, uint32_t data_type) {
-  uint32_t *value = ((uint32_t *)inlineFind(key, 0));
-  if (value == nullptr) {
-    return nullptr;
+  std::vector<std::thread> threads;
+  for (uint32_t i = 1; i < thread_count; i++) {
+    threads.emplace_back(worker);
   }
-
-  uint32_t *key_ptr = value - 1;
-  assert(*key_ptr == transform_key(key));
-  *key_ptr = TOMBSTONE_KEY;
-  if (data_type <= sizeof(uint32_t)) {
-    return value;
-  } else {
-    return ((char *)(&data[this->capa * 2])) + *value * data_type;
+  worker();
+  for (std::thread &thread : threads) {
+    thread.join();
   }
 }
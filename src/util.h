@@ -32,15 +32,80 @@ template <> struct hash<String> {
 };
 } // namespace std
 
+#define BUCKET_SIZE 1024
+#define BUCKET_MAX_SIZE (2 * 1024 * 1024)
+#define BUCKET_ALIGNMENT 16
+
 // Got idea from Jonathan Blow's video on macros and iteration.
+// Buckets start at `bucket_size` bytes and double as they fill, up to
+// `max_bucket_size`, so a big arena takes few allocations. An allocation
+// bigger than half a bucket gets a bucket of its own. Buckets of
+// BUCKET_MMAP_SIZE or more are mapped directly; with `huge_pages` set they're
+// also rounded up to whole huge pages and marked for transparent huge pages.
+// free() keeps the current bucket size, since an arena that's reused usually
+// fills up about as much again.
+//
+// mark() and rewind() free everything allocated in between, for attempts
+// that get thrown away, like a chunk the parallel lexer or parser has to
+// redo. The biggest bucket a rewind frees is kept as `spare`, so the next
+// bucket needed doesn't have to be allocated again.
+//
+// The counters behind stats() are a few adds per allocation, so they're
+// always kept.
+//
+// Memory can't be freed one allocation at a time, but a block from
+// add_block() can be given back with free_block(), for the next add_block()
+// of the same size to reuse; tables that grow by doubling go through the
+// same sizes over and over. Free blocks are forgotten on rewind().
+//
+// An arena isn't synchronized, so each thread or unit of parallel work gets
+// its own, and whoever merges the results adopts them: their buckets move
+// over as they are, so pointers into them stay valid, and the adopting
+// arena's free() releases them with its own.
 // This is a pass-by-reference/pointer datastructure.
 struct BucketArray {
   struct Bucket {
     char *begin;
     char *progress;
+    char *end;
+  };
+
+  // Where the arena is. Mark{} is the empty arena.
+  struct Mark {
+    uint32_t bucket_count;
+    Bucket last;
+  };
+
+  struct Stats {
+    uint64_t allocations;   // add() calls, ever
+    uint64_t requested;     // bytes they asked for
+    uint64_t padding;       // bytes they skipped for alignment
+    uint64_t reserved;      // bytes in buckets now, the spare included
+    uint64_t peak_reserved; // most bytes ever in buckets at once
+    uint64_t used;          // bytes handed out from the buckets now
+    uint64_t free_blocks;   // bytes of those given back to free_block()
+    uint32_t bucket_count;
+  };
+
+  // A stack of free blocks of one size, linked through their first bytes.
+  struct FreeList {
+    uint64_t size;
+    char *head;
   };
 
   std::vector<Bucket> buckets;
+  Bucket spare = {nullptr, nullptr, nullptr};
+  std::vector<FreeList> free_lists;
+  uint64_t free_block_bytes = 0;
+  uint64_t bucket_size = BUCKET_SIZE;
+  uint64_t max_bucket_size = BUCKET_MAX_SIZE;
+  bool huge_pages = false;
+
+  uint64_t allocation_count = 0;
+  uint64_t requested_bytes = 0;
+  uint64_t padding_bytes = 0;
+  uint64_t reserved_bytes = 0;
+  uint64_t peak_reserved_bytes = 0;
 
   BucketArray() noexcept = default;
   BucketArray &operator=(const BucketArray &) = delete;
@@ -50,13 +115,31 @@ struct BucketArray {
 
   void free();
 
+  // Takes over `other`'s buckets, leaving it empty. Rewinding to a mark
+  // taken before frees them.
+  void adopt(BucketArray *other) noexcept;
+
+  // Marks taken after `mark` are invalid once it's been rewound to.
+  Mark mark() noexcept;
+  void rewind(Mark mark) noexcept;
+
   template <class Type> Type *add() noexcept {
-    return (Type *)add(sizeof(Type));
+    return (Type *)add(sizeof(Type), alignof(Type));
   }
 
-  char *add(uint64_t size) noexcept;
+  // `alignment` has to be a power of two.
+  char *add(uint64_t size, uint64_t alignment = BUCKET_ALIGNMENT) noexcept;
+  // Blocks are at least a pointer big, and aligned like add()'s default.
+  char *add_block(uint64_t size) noexcept;
+  void free_block(char *block, uint64_t size) noexcept;
+  Bucket new_bucket(uint64_t size) noexcept;
+  void release(Bucket bucket) noexcept;
+
+  Stats stats() const;
 };
 
+std::ostream &operator<<(std::ostream &os, const BucketArray::Stats &stats);
+
 // This is a pass-by-reference/pointer datastructure.
 struct Pool {
   char *begin;
@@ -83,28 +166,8 @@ struct Pool {
   }
 };
 
-struct Hash {
-  uint32_t capa;
-  uint32_t size;
-  uint32_t *data;
-  BucketArray *buckets;
-
-  Hash(BucketArray *buckets, uint32_t size, uint32_t data_type);
-
-  inline void *inlineFind(uint32_t key, uint32_t data_type);
-  inline void *inlineInsert(uint32_t key, uint32_t data_type);
-  inline void *inlineRemove(uint32_t key, uint32_t data_type);
-  void *find(uint32_t key, uint32_t data_type);
-  void *insert(uint32_t key, uint32_t data_type);
-  void *remove(uint32_t key, uint32_t data_type);
-
-  template <class C> C *find(uint32_t key) {
-    return (C *)inlineFind(key, sizeof(C));
-  }
-  template <class C> C *insert(uint32_t key) {
-    return (C *)inlineInsert(key, sizeof(C));
-  }
-  template <class C> C *remove(uint32_t key) {
-    return (C *)inlineRemove(key, sizeof(C));
-  }
-};
+// Runs job(i) for every i in [0, count) on up to thread_count threads, the
+// calling thread included, and returns once all of them are done. Jobs are
+// handed out one index at a time, so uneven jobs still balance.
+void parallel_for(uint32_t count, uint32_t thread_count,
+                  const std::function<void(uint32_t)> &job);
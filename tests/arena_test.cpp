@@ -0,0 +1,110 @@
+#include "test.h"
+#include "util.h"
+#include <cstring>
+#include <vector>
+
+// BucketArray: random allocations, marks and rewinds, checking that what's
+// still allocated keeps its contents and alignment, and adopting arenas.
+
+struct Allocation {
+  char *data;
+  uint32_t size;
+  uint8_t fill;
+};
+
+static bool intact(const std::vector<Allocation> &allocations, size_t begin) {
+  for (size_t i = begin; i < allocations.size(); i++) {
+    const Allocation &allocation = allocations[i];
+    for (uint32_t j = 0; j < allocation.size; j++) {
+      if ((uint8_t)allocation.data[j] != allocation.fill) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+static bool check_rewind(uint32_t seed, bool huge_pages) {
+  TestRandom random(seed);
+  BucketArray buckets;
+  buckets.huge_pages = huge_pages;
+  std::vector<Allocation> allocations;
+  std::vector<std::pair<BucketArray::Mark, size_t>> marks;
+
+  for (uint32_t i = 0; i < 100000; i++) {
+    uint32_t op = random.below(100);
+    if (op < 2) {
+      marks.push_back({buckets.mark(), allocations.size()});
+    } else if (op < 4 && !marks.empty()) {
+      check(intact(allocations, marks.back().second));
+      buckets.rewind(marks.back().first);
+      allocations.resize(marks.back().second);
+      marks.pop_back();
+    } else {
+      uint32_t size = random.below(64) < 2 ? 1000 + random.below(30000)
+                                           : random.below(128);
+      uint32_t alignment = 1u << random.below(8);
+      char *data = buckets.add(size, alignment);
+      check((uint64_t)data % alignment == 0);
+      uint8_t fill = random.next();
+      memset(data, fill, size);
+      allocations.push_back({data, size, fill});
+    }
+  }
+  check(intact(allocations, 0));
+
+  buckets.rewind(BucketArray::Mark{});
+  check(buckets.buckets.empty());
+  check(buckets.stats().used == 0);
+  buckets.free();
+  return true;
+}
+
+// Adopted buckets keep their contents, and are freed by a rewind to a mark
+// taken before they were adopted.
+static bool check_adopt() {
+  BucketArray buckets;
+  std::vector<Allocation> allocations;
+  for (uint32_t i = 0; i < 100; i++) {
+    char *data = buckets.add(100);
+    memset(data, 1, 100);
+    allocations.push_back({data, 100, 1});
+  }
+  BucketArray::Mark mark = buckets.mark();
+  size_t kept = allocations.size();
+
+  for (uint8_t chunk = 2; chunk < 10; chunk++) {
+    BucketArray other;
+    for (uint32_t i = 0; i < 1000; i++) {
+      char *data = other.add(chunk * 10);
+      memset(data, chunk, chunk * 10);
+      allocations.push_back({data, chunk * 10u, chunk});
+    }
+    uint64_t requested = buckets.stats().requested;
+    uint64_t added = other.stats().requested;
+    buckets.adopt(&other);
+    check(other.buckets.empty() && other.stats().reserved == 0);
+    check(buckets.stats().requested == requested + added);
+    other.free();
+  }
+  // Allocations after adopting still fill the last bucket.
+  char *data = buckets.add(16);
+  memset(data, 10, 16);
+  allocations.push_back({data, 16, 10});
+  check(intact(allocations, 0));
+
+  buckets.rewind(mark);
+  allocations.resize(kept);
+  check(intact(allocations, 0));
+  buckets.free();
+  return true;
+}
+
+int main() {
+  bool ok = true;
+  for (uint32_t seed = 1; seed <= 4; seed++) {
+    ok = check_rewind(seed, seed == 4) && ok;
+  }
+  ok = check_adopt() && ok;
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,149 @@
+#include "hash.h"
+#include "interner.h"
+#include "test.h"
+#include <string>
+#include <unordered_map>
+#include <deque>
+
+// Hash against std::unordered_map under random inserts, finds, removes and
+// reserves, and the footprint of tables under churn.
+
+struct Big {
+  uint64_t a, b, c;
+};
+
+// One table with values bigger than a slot's key, one with small values,
+// and one with cached string hashes, all following the same operations.
+static bool check_against_map(uint32_t seed, bool clustered) {
+  TestRandom random(seed);
+  BucketArray buckets;
+  Hash<uint32_t, Big> big(&buckets, random.below(40));
+  Hash<uint32_t, uint32_t> small(&buckets, 3);
+  Hash<String, uint32_t, StringHash> strings(&buckets, 1);
+  std::unordered_map<uint32_t, uint32_t> map;
+  // A deque, so the text of the keys in the table stays where it is.
+  std::deque<std::string> texts;
+
+  uint32_t range = 1 + random.below(20000);
+  auto text = [&](uint32_t key) {
+    texts.push_back(std::to_string(key));
+    return String(texts.back().data(), texts.back().size());
+  };
+  for (uint32_t i = 0; i < 100000; i++) {
+    uint32_t op = random.below(100), key = random.below(range);
+    if (clustered) {
+      key <<= 16;
+    }
+
+    if (op < 45) {
+      uint32_t value = random.next();
+      *big.insert(key) = Big{value, value + 1, value + 2};
+      *small.insert(key) = value;
+      *strings.insert(text(key)) = value;
+      map[key] = value;
+    } else if (op < 70) {
+      auto it = map.find(key);
+      Big *b = big.find(key);
+      uint32_t *s = small.find(key);
+      uint32_t *str = strings.find(text(key));
+      texts.pop_back();
+      if (it == map.end()) {
+        check(b == nullptr && s == nullptr && str == nullptr);
+      } else {
+        check(b != nullptr && s != nullptr && str != nullptr);
+        check(b->a == it->second && b->c == it->second + 2);
+        check(*s == it->second && *str == it->second);
+      }
+    } else if (op < 99) {
+      bool had = map.erase(key) != 0;
+      check((big.remove(key) != nullptr) == had);
+      check((small.remove(key) != nullptr) == had);
+      check((strings.remove(text(key)) != nullptr) == had);
+      texts.pop_back();
+    } else {
+      uint32_t count = map.size() + random.below(1000);
+      big.reserve(count);
+      small.reserve(count);
+      strings.reserve(count);
+    }
+    check(big.size == map.size() && small.size == map.size() &&
+          strings.size == map.size());
+  }
+
+  for (auto &entry : map) {
+    Big *b = big.find(entry.first);
+    check(b != nullptr && b->a == entry.second);
+  }
+  big.free();
+  small.free();
+  strings.free();
+  buckets.free();
+  return true;
+}
+
+// Keys that fit before reserve() was called don't grow the table.
+static bool check_reserve() {
+  BucketArray buckets;
+  Hash<uint32_t, uint32_t> hash(&buckets);
+  hash.reserve(5000);
+  uint32_t capa = hash.capa;
+  for (uint32_t i = 0; i < 5000; i++) {
+    *hash.insert(i * 7919) = i;
+  }
+  check(hash.capa == capa);
+  buckets.free();
+  return true;
+}
+
+// A table with a steady number of keys stays the same size however many
+// keys come and go.
+static bool check_churn() {
+  BucketArray buckets;
+  Hash<uint32_t, uint32_t> hash(&buckets, 8);
+  uint32_t next = 0;
+  for (; next < 1000; next++) {
+    *hash.insert(next) = next;
+  }
+  uint32_t capa = 0;
+  for (uint32_t i = 0; i < 1000000; i++) {
+    check(hash.remove(next - 1000) != nullptr);
+    *hash.insert(next) = next;
+    next++;
+    capa = hash.capa > capa ? hash.capa : capa;
+  }
+  check(capa <= 2048);
+  for (uint32_t key = next - 1000; key < next; key++) {
+    uint32_t *value = hash.find(key);
+    check(value != nullptr && *value == key);
+  }
+  check(hash.find(next - 1001) == nullptr);
+  check(buckets.stats().peak_reserved < 64 * 1024);
+  buckets.free();
+  return true;
+}
+
+// Tables that are filled and freed one after another reuse the same block.
+static bool check_scopes() {
+  BucketArray buckets;
+  for (uint32_t scope = 0; scope < 10000; scope++) {
+    Hash<uint32_t, Big> hash(&buckets, 8);
+    for (uint32_t key = 0; key < 100; key++) {
+      hash.insert(key * 7919)->a = key;
+    }
+    hash.free();
+  }
+  check(buckets.stats().peak_reserved < 64 * 1024);
+  buckets.free();
+  return true;
+}
+
+int main() {
+  bool ok = true;
+  for (uint32_t seed = 1; seed <= 6; seed++) {
+    ok = check_against_map(seed, seed % 3 == 0) && ok;
+  }
+  ok = check_reserve() && ok;
+  ok = check_churn() && ok;
+  ok = check_scopes() && ok;
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,121 @@
+#include "incremental_lexer.h"
+#include "source.h"
+#include "test.h"
+#include <string>
+#include <vector>
+
+// IncrementalLexer against lexing the whole text again, after each of a
+// series of random edits. The edits open and close parentheses, change
+// indentation and continue lines, so they move the lexer state that the
+// segments after them depend on.
+
+static const char *snippets[] = {
+    "\n",  "\n    ", "x = 1\n", "(",    ")",  "  ",  "\n  y = (a,\n b)\n",
+    "foo", "3.25",   "\\\n",    "\t",   "\r\n", "if", " + ",
+    "@",   "def f(a):\n    return a\n"};
+
+static std::string generate_source(TestRandom &random, uint32_t lines) {
+  static const char *words[] = {"alpha", "x",  "count", "def", "pass",
+                                "return", "if", "12",    "3.5", "0x1f"};
+  static const char *operators[] = {"+", "*", "==", "<=", "=", ",",
+                                    "(", ")", ".",  "-"};
+  std::string text;
+  uint32_t indentation = 0;
+  for (uint32_t i = 0; i < lines; i++) {
+    uint32_t r = random.below(20);
+    if (r == 0 && indentation < 4) {
+      indentation++;
+    } else if (r == 1 && indentation > 0) {
+      indentation--;
+    }
+    text += std::string(indentation * 2, ' ');
+    for (uint32_t j = random.below(10); j > 0; j--) {
+      text += random.below(2) ? words[random.below(10)]
+                              : operators[random.below(10)];
+      text += ' ';
+    }
+    text += random.below(50) == 0 ? "\\\n" : "\n";
+  }
+  return text;
+}
+
+static bool same_token(const Token &a, Lexer &a_lexer, const Token &b,
+                       Lexer &b_lexer) {
+  if (a.type != b.type || a.view.begin != b.view.begin ||
+      a.view.end != b.view.end) {
+    return false;
+  }
+  switch (a.type) {
+  case TokenType::IDENT:
+    return a_lexer.identifiers.get(a.identifier_idx) ==
+           b_lexer.identifiers.get(b.identifier_idx);
+  case TokenType::INTEGER:
+  case TokenType::FLOATING_POINT:
+    return a.integer_value == b.integer_value;
+  default:
+    return true;
+  }
+}
+
+static bool check_edits(uint32_t seed, uint32_t lines, uint32_t edits) {
+  TestRandom random(seed);
+  std::string text = generate_source(random, lines);
+  SourceFile *source = new SourceFile;
+  source->load_string(text.c_str());
+  BucketArray buckets;
+  IncrementalLexer incremental(&buckets, source->view());
+
+  for (uint32_t i = 0; i < edits; i++) {
+    uint64_t offset = random.below(text.size() + 1);
+    uint64_t removed = 0;
+    if (random.below(3) == 0) {
+      removed = std::min<uint64_t>(random.below(20), text.size() - offset);
+    }
+    std::string inserted;
+    for (uint32_t j = random.below(3); j > 0; j--) {
+      inserted += snippets[random.below(sizeof(snippets) / sizeof(*snippets))];
+    }
+    text.replace(offset, removed, inserted);
+
+    SourceFile *next = new SourceFile;
+    next->load_string(text.c_str());
+    TextEdit edit = {offset, removed,
+                     String(next->data + offset, inserted.size())};
+    incremental.apply_edit(next->view(), edit);
+    source->free();
+    delete source;
+    source = next;
+
+    BucketArray full_buckets;
+    Lexer full(&full_buckets, source->view());
+    std::vector<Token> expected, tokens;
+    full.lex_all(expected);
+    incremental.copy_tokens(tokens);
+    check(tokens.size() == expected.size());
+    for (size_t j = 0; j < tokens.size(); j++) {
+      check(same_token(expected[j], full, tokens[j], incremental.lexer));
+    }
+
+    std::vector<Lexer::LexError> errors;
+    incremental.copy_errors(errors);
+    check(errors.size() == full.errors.size());
+    for (size_t j = 0; j < errors.size(); j++) {
+      check(errors[j].location.begin == full.errors[j].location.begin);
+      check(errors[j].message == full.errors[j].message);
+    }
+    full_buckets.free();
+  }
+
+  source->free();
+  delete source;
+  buckets.free();
+  return true;
+}
+
+int main() {
+  bool ok = true;
+  ok = check_edits(1, 20, 2000) && ok;
+  ok = check_edits(2, 300, 1000) && ok;
+  ok = check_edits(3, 3000, 200) && ok;
+  return ok ? 0 : 1;
+}
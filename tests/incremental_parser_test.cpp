@@ -0,0 +1,256 @@
+#include "incremental_parser.h"
+#include "source.h"
+#include "test.h"
+#include <cstring>
+#include <sstream>
+#include <string>
+
+// IncrementalParser against parsing the whole text again, after each of a
+// series of random edits. An edit that breaks the text has to fail the same
+// way the full parse does, and leave the program as it was; it's then
+// undone, so the edits keep landing on a program that parses. With deferred
+// bodies, some of the bodies are parsed after each edit too.
+
+static const char *snippets[] = {
+    "x = (a, b)\n", "f(1)\n",       "7",          "q",       " ",
+    "\n",           "*2",           "-",          "pass\n",  ".k",
+    "\n\n",         "(",            ")",          ",",       "=",
+    "1.5",          "  ",           "  y = 2\n",  "\n  pass\n",
+    "def q(a):\n  x\n",             "    return 1\n",
+    "def r():\n    def s(b):\n        return b\n"};
+
+static std::string generate_source(TestRandom &random, uint32_t statements) {
+  std::string text;
+  for (uint32_t i = 0; i < statements; i++) {
+    std::string n = std::to_string(i);
+    switch (random.below(5)) {
+    case 0:
+      text += "v" + n + " = f(a + " + n + ", b * 2, (1, c)) - x.k\n";
+      break;
+    case 1:
+      text += "g" + n + "(v, " + n + ".5)\n\n";
+      break;
+    case 2:
+      text += "def fn" + n + "(a, b):\n    v = a + " + n +
+              "\n    w = (v,\n        b)\n    return v\n";
+      break;
+    case 3:
+      text += "def outer" + n + "():\n    def inner(c):\n        return c\n" +
+              "    return inner(" + n + ")\n";
+      break;
+    default:
+      text += "pass\n";
+    }
+  }
+  return text;
+}
+
+// The tree with identifiers spelled out, since the two parsers number them
+// differently, and spans, which the incremental parser keeps up to date.
+static void print_expr(std::ostream &os, const Program &program, Lexer &lexer,
+                       uint32_t idx) {
+  const Expr &expr = program.exprs[idx];
+  Span span = program.expr_spans[idx];
+  os << (int)expr.type << "[" << span.begin << "," << span.end << "]";
+  switch (expr.type) {
+  case ExprType::None:
+    return;
+  case ExprType::Int:
+  case ExprType::Float:
+    os << expr.int_value();
+    return;
+  case ExprType::Ident: {
+    String name = lexer.identifiers.get(expr.ident());
+    os << std::string(name.begin, name.end);
+    return;
+  }
+  case ExprType::Tup:
+    os << "(";
+    for (const uint32_t *child = program.children_begin(expr);
+         child != program.children_end(expr); child++) {
+      print_expr(os, program, lexer, *child);
+      os << ",";
+    }
+    os << ")";
+    return;
+  case ExprType::Neg:
+  case ExprType::Deref:
+  case ExprType::Range:
+  case ExprType::RangePrefix:
+  case ExprType::RangePostfix:
+    os << "(";
+    print_expr(os, program, lexer, expr.operand());
+    os << ")";
+    return;
+  default:
+    os << "(";
+    print_expr(os, program, lexer, expr.a);
+    os << " ";
+    print_expr(os, program, lexer, expr.b);
+    os << ")";
+  }
+}
+
+static void print_stmt(std::ostream &os, const Program &program, Lexer &lexer,
+                       const Stmt &stmt, Span span) {
+  os << (int)stmt.type << "{" << span.begin << "," << span.end << "} ";
+  if (stmt.type == StmtType::Def) {
+    const Function &function = program.functions[stmt.function()];
+    print_expr(os, program, lexer, function.name);
+    os << " body[" << function.body.begin << "," << function.body.end
+       << "] " << function.indentation << " (";
+    for (uint32_t i = 0; i < function.param_count; i++) {
+      print_expr(os, program, lexer, program.extra[function.params + i]);
+      os << ",";
+    }
+    os << ")";
+    if (!function.parsed) {
+      os << " deferred\n";
+      return;
+    }
+    os << " {\n";
+    for (uint32_t i = function.body_begin;
+         i < function.body_begin + function.body_count; i++) {
+      print_stmt(os, program, lexer, program.body_statements[i],
+                 program.body_statement_spans[i]);
+    }
+    os << "}\n";
+    return;
+  }
+  if (stmt.type != StmtType::Pass) {
+    print_expr(os, program, lexer, stmt.a);
+  }
+  if (stmt.type == StmtType::Assign) {
+    os << " = ";
+    print_expr(os, program, lexer, stmt.assign_value());
+  }
+  os << "\n";
+}
+
+static std::string print_program(const Program &program, Lexer &lexer) {
+  std::ostringstream os;
+  for (uint32_t i = 0; i < program.statements.size(); i++) {
+    print_stmt(os, program, lexer, program.statements[i],
+               program.statement_spans[i]);
+  }
+  return os.str();
+}
+
+static bool same_error(const Parser &a, const Parser &b) {
+  return a.error.location.begin == b.error.location.begin &&
+         strcmp(a.error.message, b.error.message) == 0;
+}
+
+static bool check_edits(uint32_t seed, bool lazy, uint32_t statements,
+                        uint32_t edits) {
+  TestRandom random(seed);
+  std::string text = generate_source(random, statements);
+  SourceFile *source = new SourceFile;
+  source->load_string(text.c_str());
+  BucketArray buckets;
+  IncrementalParser incremental(&buckets, source->view());
+  if (lazy) {
+    incremental.parser.defer_bodies = true;
+    incremental.reparse(source->view());
+  }
+  check(incremental.parsed);
+
+  for (uint32_t i = 0; i < edits; i++) {
+    uint64_t offset = random.below(text.size() + 1);
+    uint64_t removed = 0;
+    if (random.below(3) == 0) {
+      removed = std::min<uint64_t>(random.below(21), text.size() - offset);
+    }
+    std::string inserted;
+    for (uint32_t j = 1 + random.below(2); j > 0; j--) {
+      inserted += snippets[random.below(sizeof(snippets) / sizeof(*snippets))];
+    }
+
+    // The second time round undoes a failed edit.
+    for (uint32_t undo = 0; undo < 2; undo++) {
+      std::string removed_text = text.substr(offset, removed);
+      text.replace(offset, removed, inserted);
+      SourceFile *next = new SourceFile;
+      next->load_string(text.c_str());
+      TextEdit edit = {offset, removed,
+                       String(next->data + offset, inserted.size())};
+
+      bool was_parsed = incremental.parsed;
+      uint32_t statement_count = incremental.program.statements.size();
+      NodeCounts counts = incremental.program.node_counts();
+      bool parsed = incremental.apply_edit(next->view(), edit);
+      source->free();
+      delete source;
+      source = next;
+
+      BucketArray full_buckets;
+      Parser full(&full_buckets, source->view());
+      full.defer_bodies = lazy;
+      Program program;
+      check(parsed == full.try_parse_program(program));
+
+      if (!parsed) {
+        check(same_error(full, incremental.parser));
+        if (was_parsed) {
+          Program &kept = incremental.program;
+          NodeCounts now = kept.node_counts();
+          check(kept.statements.size() == statement_count);
+          check(kept.statement_spans.size() == statement_count);
+          check(incremental.statement_nodes.size() == statement_count);
+          check(now.exprs == counts.exprs && now.extra == counts.extra);
+          check(now.functions == counts.functions);
+          check(now.body_statements == counts.body_statements);
+          check(kept.expr_spans.size() == now.exprs);
+        }
+      } else {
+        for (uint32_t j = 0; lazy && j < program.statements.size(); j++) {
+          if (program.statements[j].type != StmtType::Def) {
+            continue;
+          }
+          uint32_t expected = program.statements[j].function();
+          uint32_t actual = incremental.program.statements[j].function();
+          Function &function = incremental.program.functions[actual];
+          if (!function.parsed && random.below(3) != 0) {
+            continue;
+          }
+          bool expected_ok =
+              program.functions[expected].parsed ||
+              full.parse_body(expected, program.statement_spans[j].begin);
+          bool actual_ok = function.parsed ||
+                           incremental.parser.parse_body(
+                               actual,
+                               incremental.program.statement_spans[j].begin);
+          check(expected_ok == actual_ok);
+          if (!expected_ok) {
+            check(same_error(full, incremental.parser));
+          }
+        }
+        check(print_program(program, full.lexer) ==
+              print_program(incremental.program, incremental.parser.lexer));
+        check(incremental.line_starts.size() ==
+              incremental.program.statements.size() + 1);
+      }
+      full_buckets.free();
+
+      if (parsed || undo == 1) {
+        break;
+      }
+      removed = inserted.size();
+      inserted = removed_text;
+    }
+  }
+
+  source->free();
+  delete source;
+  buckets.free();
+  return true;
+}
+
+int main() {
+  bool ok = true;
+  ok = check_edits(1, false, 10, 2000) && ok;
+  ok = check_edits(2, false, 200, 1000) && ok;
+  ok = check_edits(3, true, 10, 2000) && ok;
+  ok = check_edits(4, true, 200, 1000) && ok;
+  return ok ? 0 : 1;
+}
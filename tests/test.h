@@ -0,0 +1,23 @@
+#pragma once
+#include <cstdint>
+#include <iostream>
+
+// Fails the enclosing check function, saying where.
+#define check(expr)                                                            \
+  if (!(expr)) {                                                               \
+    std::cout << __FILE__ << ":" << __LINE__ << ": failed: " #expr            \
+              << std::endl;                                                    \
+    return false;                                                              \
+  }
+
+// A small deterministic generator, so a failure reproduces.
+struct TestRandom {
+  uint32_t state;
+
+  explicit TestRandom(uint32_t seed) : state(seed) {}
+  uint32_t next() {
+    state = state * 1664525 + 1013904223;
+    return state ^ state >> 16;
+  }
+  uint32_t below(uint32_t n) { return next() % n; }
+};